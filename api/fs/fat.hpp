@@ -21,9 +21,11 @@
 
 #include "filesystem.hpp"
 #include <hw/disk_device.hpp>
+#include <utility/hash_table.hpp>
 #include <functional>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 namespace fs
 {
@@ -159,21 +161,61 @@ namespace fs
         return lba_base + data_index + (cl - 2) * sectors_per_cluster;
     }
     
-    uint16_t cl_to_entry_offset(uint32_t cl)
+    // byte offset of the FAT entry for @cl, from the start of the FAT
+    uint32_t cl_to_entry_byte(uint32_t cl) const
     {
-      if (fat_type == T_FAT16)
-          return (cl * 2) % sector_size;
+      if (fat_type == T_FAT12)
+          return cl + cl / 2;
+      else if (fat_type == T_FAT16)
+          return cl * 2;
       else // T_FAT32
-          return (cl * 4) % sector_size;
+          return cl * 4;
     }
-    uint16_t cl_to_entry_sector(uint32_t cl)
+    uint16_t cl_to_entry_offset(uint32_t cl) const
     {
-      if (fat_type == T_FAT16)
-          return reserved + (cl * 2 / sector_size);
-      else // T_FAT32
-          return reserved + (cl * 4 / sector_size);
+      return cl_to_entry_byte(cl) % sector_size;
+    }
+    uint32_t cl_to_entry_sector(uint32_t cl) const
+    {
+      return reserved + cl_to_entry_byte(cl) / sector_size;
+    }
+    // the cluster after @cl in its chain, from its FAT entry at @entry
+    uint32_t cl_next(uint32_t cl, const uint8_t* entry) const;
+    // true if @cl marks the end of a cluster chain
+    bool cl_is_last(uint32_t cl) const;
+    // true if @cl can be part of a cluster chain
+    bool cl_is_valid(uint32_t cl) const
+    {
+      return cl >= 2 && cl < clusters + 2;
     }
     
+    // a run of consecutive sectors of a file
+    struct Extent
+    {
+      uint32_t sector;
+      uint32_t count;
+    };
+    typedef std::vector<Extent> extents_t;
+    typedef std::function<void(error_t, std::shared_ptr<extents_t>)> on_extents_func;
+    // most sectors in one extent, and so in one device read when copying
+    static const uint32_t EXTENT_MAX = 2048;
+    // FAT sectors read at once while walking a chain
+    static const uint32_t FAT_WINDOW = 16;
+    
+    // walk the cluster chain of @ent once, into runs of consecutive sectors
+    struct chain_walk;
+    void extents(const Dirent& ent, on_extents_func);
+    void walk_chain(std::shared_ptr<chain_walk>, uint32_t cl);
+    // follow the chain on from @cl for as long as its FAT entries are in @fat,
+    // which holds the bytes from @start to @end of the FAT
+    error_t follow_chain(chain_walk&, uint32_t& cl,
+                         const uint8_t* fat, uint32_t start, uint32_t end);
+    // append @cl to @exts, extending the last extent when consecutive
+    void add_cluster(extents_t& exts, uint32_t cl, uint32_t& sectors_left);
+    // read every extent into one buffer
+    struct extent_read;
+    void read_extents(std::shared_ptr<extent_read>, size_t idx);
+    
     // initialize filesystem by providing base sector
     void init(const void* base_sector);
     // return a list of entries from directory entries at @sector
@@ -181,6 +223,14 @@ namespace fs
     void int_ls(uint32_t sector, dirvec_t, on_internal_ls_func);
     bool int_dirent(uint32_t sector, const void* data, dirvec_t);
     
+    // directory index
+    // remember the entries of directory @key (its path, ending with /)
+    void index_dir(const std::string& key, dirvec_t ents);
+    // sync listing of directory @key at @cluster, from the index when there
+    error_t index_ls(const std::string& key, uint32_t cluster, dirvec_t& ents);
+    // forget every directory listed so far
+    void invalidate();
+    
     // tree traversal
     typedef std::function<void(error_t, dirvec_t)> cluster_func;
     // async tree traversal
@@ -212,6 +262,14 @@ namespace fs
     uint32_t root_cluster;  // index of root cluster
     uint32_t data_index;    // index of first data sector (relative to partition)
     uint32_t data_sectors;  // number of data sectors
+    
+    // the allocation table, loaded at mount unless it's larger than TABLE_MAX
+    buffer_t table;
+    static const uint32_t TABLE_MAX = 4 << 20;
+    // directory path -> its entries, for the directories listed so far
+    HashTable<std::string, dirvec_t> dirs;
+    // full path -> entry, for everything in those directories
+    HashTable<std::string, Dirent> index;
   };
   
 } // fs
@@ -127,7 +127,11 @@ public:
     virtual void    ls(const std::string& path, on_ls_func) = 0;
     virtual error_t ls(const std::string& path, dirvec_t e) = 0;
     
-    /** Read an entire file into a buffer, then call on_read */
+    /**
+     *  Read an entire file into a buffer, then call on_read
+     *  The buffer may be shared with the disk device (on MemDisk, it's
+     *  the disk image itself) - don't modify it.
+     */
     virtual void readFile(const std::string&, on_read_func) = 0;
     virtual void readFile(const Dirent& ent,  on_read_func) = 0;
     
@@ -25,6 +25,12 @@
 
 namespace fs {
 
+/**
+ *  Disk backed by the image linked into the service
+ *
+ *  Reads don't copy anything: the buffers are views right into the image.
+ *  Don't modify them.
+ */
 class MemDisk : public hw::IDiskDevice {
 public:
   static constexpr size_t SECTOR_SIZE = 512;
@@ -51,6 +57,9 @@ public:
   virtual block_t size() const noexcept override;
   
 private:
+  /** A view of count blocks from blk, or null if outside of the image */
+  buffer_t view(block_t blk, block_t count) const;
+  
   void*  image_start;
   void*  image_end;
 }; //< class MemDisk
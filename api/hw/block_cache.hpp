@@ -0,0 +1,174 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#ifndef HW_BLOCK_CACHE_HPP
+#define HW_BLOCK_CACHE_HPP
+
+#include <vector>
+#include <utility/hash_table.hpp>
+#include "disk_device.hpp"
+
+namespace hw {
+
+/**
+ *  Block cache in front of any disk device
+ *
+ *  Is a disk device itself, so a filesystem can sit on top of it just
+ *  like on MemDisk, IDE or VirtioBlk:
+ *
+ *    hw::BlockCache cache {hw::Dev::disk<0, VirtioBlk>(), 4 << 20};
+ *    fs::Disk<fs::FAT> disk {cache};
+ *
+ *  - Blocks are replaced with CLOCK (second chance), within a memory budget
+ *  - Reads of a block already on its way from the device wait for that
+ *    read, rather than asking again
+ *  - Sequential single block reads make the next misses read ahead
+ *  - Reads of more blocks than the read-ahead go straight to the device,
+ *    and aren't cached - streaming a large file doesn't push out the rest
+ *  - Writes go through to the device, and drop what's cached for them
+ *
+ *  @note: Buffers handed out are shared with the cache - don't modify them.
+ *         Every cached block has a buffer of its own, so the budget holds.
+ */
+class BlockCache : public IDiskDevice {
+public:
+  /**
+   *  @param device:    The device to cache blocks of
+   *  @param budget:    Most octets of blocks to keep
+   *  @param readahead: Blocks to read at once on sequential misses
+   */
+  explicit BlockCache(IDiskDevice& device, size_t budget = 1 << 20,
+                      block_t readahead = 8);
+
+  virtual const char* name() const noexcept override
+  { return device_.name(); }
+
+  virtual block_t size() const noexcept override
+  { return device_.size(); }
+
+  virtual block_t block_size() const noexcept override
+  { return device_.block_size(); }
+
+  virtual void read(block_t blk, on_read_func func) override;
+
+  virtual void read(block_t blk, block_t count, on_read_func func) override;
+
+  virtual buffer_t read_sync(block_t blk) override;
+
+  virtual void write(block_t blk, block_t count, buffer_t buf, on_write_func func) override;
+
+  virtual void flush(on_write_func func) override
+  { device_.flush(func); }
+
+  /** The device behind the cache */
+  IDiskDevice& device() noexcept
+  { return device_; }
+
+  /** Forget everything cached */
+  void clear();
+
+  /** Blocks to read at once on sequential misses, and the most a read
+      can be and still be cached. 1 turns read-ahead off */
+  void set_readahead(block_t blocks) noexcept
+  { readahead_ = blocks ? blocks : 1; }
+
+  /** Blocks the budget has room for */
+  inline size_t capacity() const noexcept
+  { return capacity_; }
+
+  /** Blocks cached now */
+  inline size_t cached() const noexcept
+  { return index_.size(); }
+
+  /** Blocks found in the cache */
+  inline uint64_t hits() const noexcept
+  { return hits_; }
+
+  /** Blocks that had to come from the device */
+  inline uint64_t misses() const noexcept
+  { return misses_; }
+
+  /** Misses that waited for a read already on its way */
+  inline uint64_t coalesced() const noexcept
+  { return coalesced_; }
+
+  /** Blocks read ahead of being asked for */
+  inline uint64_t read_ahead() const noexcept
+  { return read_ahead_; }
+
+  /** Blocks dropped to make room */
+  inline uint64_t evictions() const noexcept
+  { return evictions_; }
+
+  /** Blocks of large reads, that went past the cache */
+  inline uint64_t streamed() const noexcept
+  { return streamed_; }
+
+private:
+  struct Slot {
+    block_t  blk  = 0;
+    buffer_t data;
+    bool     referenced = false;
+  };
+
+  IDiskDevice& device_;
+  size_t   capacity_;
+  block_t  readahead_;
+
+  /** CLOCK: Slots in a circle, and the hand sweeping over them */
+  std::vector<Slot> slots_;
+  size_t hand_ = 0;
+  /** Block -> slot */
+  HashTable<block_t, uint32_t> index_;
+  /** Block -> reads waiting for it */
+  HashTable<block_t, std::vector<on_read_func>> pending_;
+  /** The block after the last one read, to see sequential reads.
+      Starts past any block, so that the first read isn't one */
+  block_t next_ = ~block_t(0);
+  /** Bumped by writes. Reads from before one aren't cached */
+  uint32_t generation_ = 0;
+
+  uint64_t hits_       = 0;
+  uint64_t misses_     = 0;
+  uint64_t coalesced_  = 0;
+  uint64_t read_ahead_ = 0;
+  uint64_t evictions_  = 0;
+  uint64_t streamed_   = 0;
+
+  /** The cached block, or nullptr. Marks it referenced */
+  buffer_t* lookup(block_t blk);
+
+  /** Cache a block, in a free slot or the one CLOCK picks */
+  void insert(block_t blk, buffer_t data, bool referenced);
+
+  /** Drop blk to count blocks from the cache */
+  void invalidate(block_t blk, block_t count);
+
+  /** Read count blocks from blk from the device for func, and cache them */
+  void fetch(block_t blk, block_t count, on_read_func func);
+
+  /** A copy of the block at data, to cache on its own */
+  buffer_t copy_block(const uint8_t* data) const;
+
+  /** A fetch is done: cache the blocks, and hand them to those waiting */
+  void fetched(block_t blk, block_t count, buffer_t buf, uint32_t generation);
+}; //< class BlockCache
+
+} //< namespace hw
+
+#endif //< HW_BLOCK_CACHE_HPP
@@ -52,11 +52,26 @@ public:
     return driver.read_sync(blk);
   }
   
+  virtual void
+  write(block_t blk, block_t count, buffer_t buf, on_write_func del) override
+  {
+    driver.write(blk, count, buf, del);
+  }
+  
+  virtual void flush(on_write_func del) override
+  {
+    driver.flush(del);
+  }
+  
   virtual block_t size() const noexcept override
   {
     return driver.size();
   }
   
+  /** The driver itself, for what only it has */
+  DRIVER& get_driver() noexcept
+  { return driver; }
+  
   virtual ~Disk() = default;
   
 private:
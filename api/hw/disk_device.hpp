@@ -34,6 +34,9 @@ public:
   // Delegate for result of reading a disk sector
   using on_read_func = std::function<void(buffer_t)>;
   
+  // Delegate for result of a write or flush, false if it failed
+  using on_write_func = std::function<void(bool)>;
+  
   /** Human-readable name of this disk controller  */
   virtual const char* name() const noexcept = 0;
   
@@ -56,6 +59,18 @@ public:
   /** read synchronously the block @blk  */
   virtual buffer_t read_sync(block_t blk) = 0;
   
+  /**
+   *  Write count blocks from buf, starting at blk, and call func with
+   *  whether it succeeded. buf is held on to until then.
+   *  Devices are read-only unless they say otherwise.
+  **/
+  virtual void write(block_t, block_t, buffer_t, on_write_func func)
+  { func(false); }
+  
+  /** Make completed writes durable, then call func */
+  virtual void flush(on_write_func func)
+  { func(true); }
+  
   /** Default destructor */
   virtual ~IDiskDevice() noexcept = default;
 }; //< class IDiskDevice
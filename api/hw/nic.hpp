@@ -56,12 +56,29 @@ public:
   
   inline void transmit(net::Packet_ptr pckt)
   { driver_.transmit(pckt); }
+
+  /** Number of frames the device can take right now. 0 means it's full,
+      and transmitted frames will have to wait in the driver. */
+  inline size_t transmit_queue_available()
+  { return driver_.transmit_queue_available(); }
+
+  /** Get called when the device can take more frames */
+  inline void on_transmit_queue_available(net::transmit_avail_delg del)
+  { driver_.on_transmit_queue_available(del); }
   
   inline uint16_t MTU() const noexcept
   { return driver_.MTU(); }
   
   inline net::BufferStore& bufstore() noexcept
   { return driver_.bufstore(); }
+
+  /** Whether the device fills in partial L4 checksums. @see Packet::set_csum_partial */
+  inline bool checksum_offload() const noexcept
+  { return driver_.checksum_offload(); }
+
+  /** Whether the device segments large TCP packets. @see Packet::set_gso */
+  inline bool tso() const noexcept
+  { return driver_.tso(); }
   
 private:
   driver_t driver_;
@@ -18,7 +18,9 @@
 #pragma once
 #include <delegate>
 #include <chrono>
-#include <map>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <hertz>
 
 namespace hw {
@@ -36,18 +38,41 @@ public:
   typedef delegate<void()> timeout_handler;
   typedef std::function<bool()> repeat_condition;
   
+  /** A handle to a started timer. Stays unique after the timer is done. */
+  typedef uint64_t timer_id;
+  static constexpr timer_id NO_TIMER = 0;
+  
   /** Create a one-shot timer. 
       @param ms: Expiration time. Compatible with all std::chrono durations.
-      @param handler: A delegate or function to be called on timeout.   */
-  void onTimeout(std::chrono::milliseconds ms, timeout_handler handler);
+      @param handler: A delegate or function to be called on timeout.   
+      @return A handle, for stop_timer */
+  timer_id onTimeout(std::chrono::milliseconds ms, timeout_handler handler);
 
   /** Create a repeating timer. 
       @param ms: Expiration time. Compatible with all std::chrono durations.
       @param handler: A delegate or function to be called every ms interval. 
-      @param cond: The timer ends when cond() returns false. Default to true. */
-  void onRepeatedTimeout(std::chrono::milliseconds ms, 
+      @param cond: The timer ends when cond() returns false. Default to true. 
+      @return A handle, for stop_timer */
+  timer_id onRepeatedTimeout(std::chrono::milliseconds ms, 
 			 timeout_handler handler, 
 			 repeat_condition cond = forever);
+
+  /** Stop a timer before it expires. Its handler won't be called (again).
+      Stopping a timer that's done, or already stopped, does nothing. */
+  void stop_timer(timer_id);
+
+  /** Number of timers waiting to expire */
+  inline size_t active_timers() const { return active_timers_; }
+
+  /** Tickless mode: Rather than interrupting every millisecond, the PIT is
+      set up in one-shot mode for the next timer to expire, and time is
+      kept with the TSC. An idle system with no timers gets no interrupts.
+      On by default. */
+  void set_tickless(bool);
+  inline bool tickless() const { return tickless_; }
+
+  /** Number of timer interrupts so far */
+  static inline uint64_t interrupts() { return IRQ_counter_; }
   
   /** No copy or move. The OS owns one instance forever. */
   PIT(PIT&) = delete;
@@ -116,6 +141,9 @@ private:
   // Count the "milliseconds"
   static uint64_t millisec_counter;
 
+  // The longest one-shot the 16-bit divider allows, in milliseconds
+  static constexpr uint16_t max_oneshot_ms = 0xffff / millisec_interval;
+
   // Access mode bits are bits 4- and 5 in the Mode register
   enum AccessMode { LATCH_COUNT = 0x0, LO_ONLY=0x10, HI_ONLY=0x20, LO_HI=0x30 };
   
@@ -132,55 +160,105 @@ private:
   static uint8_t read_back(uint8_t channel);
 
   
-  /** A timer is a handler and an expiration time (interval). 
-      @todo The timer also keeps a pre-computed rdtsc-value, which is currently unused.*/
-  class Timer {
-  public:
-    enum Type { ONE_SHOT, REPEAT, REPEAT_WHILE} type_;    
+  /** A timer is a handler and an expiration time, in "milliseconds".
+      Timers are pooled, and linked into the wheel by index. */
+  struct Timer {
+    enum Type { ONE_SHOT, REPEAT, REPEAT_WHILE };
     
-    Timer() = delete;    
-    Timer(Type, timeout_handler, std::chrono::milliseconds, repeat_condition = forever);    
-    Timer(const Timer&) = default;
-    Timer(Timer&&) = default;
-    Timer& operator=(Timer&) = default;
-    Timer& operator=(Timer&&) = default;
-    virtual ~Timer() = default;
+    timeout_handler handler;
+    repeat_condition cond;
+    std::chrono::milliseconds interval;
+    uint64_t expires;
     
-    inline Type type(){ return type_; }
-    inline std::chrono::milliseconds interval(){ return interval_; }
-    inline uint64_t start() { return timestamp_start_; }
-    inline uint64_t end() { return timestamp_end_; }
-    inline void setStart(uint64_t s) { timestamp_start_ = s; }
-    inline void setEnd(uint64_t e) { timestamp_end_ = e; } 
-    inline timeout_handler handler(){ return handler_; }
-    inline const repeat_condition cond() { return cond_; }
-    inline uint32_t id(){ return id_; }
-  
-  private:
-    static uint32_t timers_count_;
-    uint32_t id_ = 0;
-    timeout_handler handler_;
-    uint64_t timestamp_start_;
-    uint64_t timestamp_end_;
-    std::chrono::milliseconds interval_;
+    // Bumped when the timer is released, which retires its handles
+    uint32_t generation = 1;
     
-    /* This Could be a reference in the default case of "forever", but then the
-       case of a normal lambda being passed in, the user would have to be in charge
-       of storage. */
-    const repeat_condition cond_;
+    // Links in the list of a wheel slot, or the free list
+    uint32_t prev;
+    uint32_t next;
+    
+    // The wheel slot it's in, or one of the below
+    uint16_t list;
+    Type type;
   };
   
-  /** A map of timers. 
-      @note {Performance: We take advantage of the fact that std::map have sorted keys. 
-      * Timers soonest to expire are in the front, so we only iterate over those
-      * Deletion of finished timers in amortized constant time, via iterators
-      * Timer insertion is log(n) }
+  /** Hierarchical timing wheel. 
+      @note {Performance: 
+      * Starting and stopping a timer is O(1): A timer goes into the slot
+        for its expiry time on the coarsest level that covers it, and is
+        unlinked from there if stopped.
+      * Every WHEEL_SIZE ms the current slot of the next level is spread
+        out over the level below, so each timer moves at most LEVELS times.
+      * A tick runs the whole slot of timers expiring on it in one go. }
       @note This is why we want to instantiate PIT, and why it's a singleton: 
       If you don't use PIT-timers, you won't pay for them. */
-  std::multimap<uint64_t,Timer> timers_;
+  static constexpr int WHEEL_BITS = 6;
+  static constexpr int WHEEL_SIZE = 1 << WHEEL_BITS;
+  static constexpr int WHEEL_MASK = WHEEL_SIZE - 1;
+  static constexpr int LEVELS = 4;
+  
+  static constexpr uint32_t NIL = UINT32_MAX;
+  
+  // List "slots" that aren't in the wheel
+  static constexpr uint16_t EXPIRING = LEVELS * WHEEL_SIZE;
+  static constexpr uint16_t RUNNING  = EXPIRING + 1;
+  static constexpr uint16_t FREE     = EXPIRING + 2;
+  
+  // Heads of each slot's list, level by level, then the expiring list
+  uint32_t wheel_[LEVELS * WHEEL_SIZE + 1];
+  
+  // Timer pool. A deque, so timers stay put while handlers add more.
+  std::deque<Timer> timers_;
+  uint32_t free_timers_ = NIL;
+  size_t active_timers_ = 0;
+  
+  // The next millisecond the wheel will process
+  uint64_t wheel_ms_ = 1;
 
-  /** Queue the timer. This will update timestamps in the timer */
-  void start_timer(Timer t, std::chrono::milliseconds);
+  // Tickless state. The millisecond the one-shot is set to go off at,
+  // and the TSC to milliseconds conversion.
+  static constexpr uint64_t NO_DEADLINE = UINT64_MAX;
+  bool tickless_ = true;
+  uint64_t next_deadline_ = NO_DEADLINE;
+  uint64_t tsc_base_ = 0;
+  double cycles_per_ms_ = 0;
+
+  /** Tickless: bring millisec_counter up to date from the TSC */
+  void update_clock();
+
+  /** Tickless: set up a one-shot for the next thing the wheel has to do */
+  void program_next();
+
+  /** The first millisecond the wheel has something to do. Either a timer
+      expires, or timers come down from the levels above. */
+  uint64_t next_expiry() const;
+  
+  /** Queue the timer to expire in_msecs from now */
+  void start_timer(uint32_t index, std::chrono::milliseconds in_msecs);
+  
+  /** Start a new timer */
+  timer_id add_timer(Timer::Type, timeout_handler, std::chrono::milliseconds, 
+                     repeat_condition);
+  
+  /** Put a timer in the wheel slot for its expiry time */
+  void insert(uint32_t index);
+  
+  /** Link / unlink a timer in the list of a slot */
+  void link(uint32_t index, uint16_t list);
+  void unlink(uint32_t index);
+  
+  /** Give a timer back to the pool */
+  void release(uint32_t index);
+  
+  /** Spread the current slot of a level over the levels below.
+      @return The index of that slot */
+  int cascade(int level);
+  
+  /** Run all timers up to millisec_counter */
+  void run_timers();
+  
+  inline static timer_id make_id(uint32_t index, uint32_t generation)
+  { return (timer_id(generation) << 32) | index; }
   
 };
 
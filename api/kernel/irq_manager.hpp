@@ -19,6 +19,7 @@
 #define KERNEL_IRQ_MANAGER_HPP
 
 #include <delegate>
+#include <vector>
 
 #include "os.hpp"
 #include "../hw/pic.hpp"
@@ -148,6 +149,15 @@ public:
    */
   static void eoi(uint8_t irq);
 
+  /**
+   *  Call a delegate from the event loop, once pending IRQs are handled
+   *  and before going to sleep.
+   *
+   *  For drivers that stopped early, e.g. on a poll budget, and want to
+   *  carry on without waiting for another IRQ. Called once per defer().
+   */
+  static void defer(irq_delegate del);
+
 private:
   static unsigned int   irq_mask;
   static int            timer_interrupts;
@@ -163,6 +173,13 @@ private:
   static void(*irq_subscribers[sizeof(irq_bitfield)*8])();
   static irq_delegate irq_delegates[sizeof(irq_bitfield)*8];
 
+  /** Work deferred until the IRQs are handled */
+  static std::vector<irq_delegate> deferred_;
+
+  /** The deferred work being done. Swapped with deferred_, so neither
+      gives up its capacity */
+  static std::vector<irq_delegate> deferred_work_;
+
   /** STI */
   static void enable_interrupts();
 
@@ -21,6 +21,7 @@
 
 #include <os>
 #include <map>
+#include <vector>
 
 #include <delegate>
 #include <net/ip4.hpp>
@@ -53,7 +54,7 @@ private:
   }; //< struct cache_entry
   
   using Cache       = std::map<IP4::addr, cache_entry>;
-  using PacketQueue = std::map<IP4::addr, Packet_ptr>;
+  using PacketQueue = std::map<IP4::addr, std::vector<Packet_ptr>>;
 public:
   /**
    *  You can assign your own ARP-resolution delegate
@@ -18,7 +18,6 @@
 #ifndef NET_BUFFER_STORE_HPP
 #define NET_BUFFER_STORE_HPP
 
-#include <deque>
 #include <stdexcept>
 
 #include <net/inet_common.hpp>
@@ -31,19 +30,36 @@ namespace net{
  * @note : The buffer store is intended to be used by Packet, which is
  * a semi-intelligent buffer wrapper, used throughout the IP-stack.
  *
+ * The store starts out with one page-aligned pool of buffers, and chains
+ * on additional pools of the same size when it runs dry, up to a ceiling.
+ * Users may register a low-watermark handler to be told when the store is
+ * about to run out, so that they can shed load instead of exhausting it.
+ *
  * There shouldn't be any need for raw buffers in services.
  **/
 class BufferStore {
 public:
   using buffer_t = uint8_t*;
   using release_del = delegate<void(buffer_t, size_t)>;
+  using watermark_del = delegate<void(BufferStore&)>;
+
+  /** Maximum number of pools a store can chain together */
+  static constexpr size_t MAX_POOLS {8};
 
-  BufferStore(size_t num, size_t bufsize, size_t device_offset);
+  /**
+   *  Constructor
+   *
+   *  @param num:           Number of buffers in each pool
+   *  @param bufsize:       Size of each buffer
+   *  @param device_offset: Bytes reserved in front of each buffer for the device
+   *  @param max_bufs:      Ceiling for the total number of buffers (0 => MAX_POOLS pools)
+   */
+  BufferStore(size_t num, size_t bufsize, size_t device_offset, size_t max_bufs = 0);
 
   /** Free all the buffers **/
   ~BufferStore();
 
-  /** Get a free buffer */
+  /** Get a free buffer. Returns nullptr if the ceiling is reached */
   buffer_t get_raw_buffer();
 
   /** Get a free buffer, offset by device-offset */
@@ -64,25 +80,72 @@ public:
 
   /** @return the total buffer capacity in bytes */
   inline size_t capacity()
-  { return available_buffers_.size() * bufsize_; }
+  { return available_ * bufsize_; }
+
+  /** Number of free buffers in the currently allocated pools */
+  inline size_t available() const noexcept
+  { return available_; }
+
+  /** Number of buffers in the currently allocated pools */
+  inline size_t total_buffers() const noexcept
+  { return pool_count_ * bufcount_; }
+
+  /** The maximum number of buffers the store is allowed to grow to */
+  inline size_t max_buffers() const noexcept
+  { return max_bufs_; }
+
+  /** Set the ceiling for the total number of buffers (rounded down to whole pools) */
+  void set_max_buffers(size_t max_bufs) noexcept;
+
+  /** Free buffers, plus the ones we're still allowed to allocate */
+  inline size_t headroom() const noexcept
+  { return available() + max_buffers() - total_buffers(); }
+
+  /**
+   *  Call handler once when the headroom drops to @threshold buffers.
+   *  The handler is re-armed when the headroom climbs above it again.
+   */
+  void on_low_watermark(size_t threshold, watermark_del handler) noexcept
+  {
+    low_watermark_ = threshold;
+    on_low_watermark_ = handler;
+  }
+
+  /** True if the headroom is at, or below, the low watermark */
+  inline bool low() const noexcept
+  { return headroom() <= low_watermark_; }
 
   /** Check if a buffer belongs here */
-  inline bool address_is_from_pool(buffer_t addr)
-  { return addr >= pool_ and addr < pool_ + (bufcount_ * bufsize_); }
+  inline bool address_is_from_pool(buffer_t addr) const noexcept
+  { return pool_of(addr) != nullptr; }
 
   /** Check if an address is the start of a buffer */
-  inline bool address_is_bufstart(buffer_t addr)
-  { return (addr - pool_) % bufsize_ == 0; }
+  inline bool address_is_bufstart(buffer_t addr) const noexcept
+  { return (addr - pool_of(addr)) % bufsize_ == 0; }
 
   /** Check if an address is the start of a buffer */
-  inline bool address_is_offset_bufstart(buffer_t addr)
-  { return (addr - pool_ - device_offset_) % bufsize_ == 0; }
+  inline bool address_is_offset_bufstart(buffer_t addr) const noexcept
+  { return (addr - pool_of(addr) - device_offset_) % bufsize_ == 0; }
 private:
   size_t               bufcount_;
   const size_t         bufsize_;
   size_t               device_offset_;
-  buffer_t             pool_;
-  std::deque<buffer_t> available_buffers_;
+  size_t               max_bufs_;
+  size_t               pool_count_ {0};
+  buffer_t             pools_[MAX_POOLS] {};
+
+  /**
+   *  Free buffers form an intrusive LIFO list, linked through their
+   *  first bytes. The most recently released (cache-hot) buffer is
+   *  handed out first, and neither get nor release touches the heap.
+   */
+  struct free_buffer { free_buffer* next; };
+  free_buffer*         free_list_ {nullptr};
+  size_t               available_ {0};
+
+  size_t               low_watermark_ {0};
+  bool                 watermark_fired_ {false};
+  watermark_del        on_low_watermark_ {[](BufferStore&){}};
 
   /** Delete move and copy operations **/
   BufferStore(BufferStore&)  = delete;
@@ -93,7 +156,34 @@ private:
   /** Prohibit default construction **/
   BufferStore() = delete;
 
-  void increaseStorage();
+  /** The pool @addr belongs to, or nullptr. Pools are equally sized, and few. */
+  inline buffer_t pool_of(buffer_t addr) const noexcept {
+    const size_t pool_bytes = bufcount_ * bufsize_;
+    for (size_t i = 0; i < pool_count_; ++i)
+      if (addr >= pools_[i] and addr < pools_[i] + pool_bytes)
+        return pools_[i];
+    return nullptr;
+  }
+
+  inline void push_free(buffer_t b) noexcept {
+    auto* fb = reinterpret_cast<free_buffer*>(b);
+    fb->next = free_list_;
+    free_list_ = fb;
+    available_++;
+  }
+
+  inline buffer_t pop_free() noexcept {
+    auto* fb = free_list_;
+    free_list_ = fb->next;
+    available_--;
+    return reinterpret_cast<buffer_t>(fb);
+  }
+
+  /** Chain on another pool. Returns false if we're at the ceiling. */
+  bool increaseStorage();
+
+  /** Fire / re-arm the low watermark handler */
+  void check_watermark();
 }; //< class BufferStore
 } //< namespace net
 
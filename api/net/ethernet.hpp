@@ -30,6 +30,7 @@ class Ethernet {
 public:
   static constexpr size_t ETHER_ADDR_LEN  = 6;
   static constexpr size_t MINIMUM_PAYLOAD = 46;
+  static constexpr size_t MAXIMUM_PAYLOAD = 1500; // The link MTU
 
   /**
    *  Some big-endian ethernet types
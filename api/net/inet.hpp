@@ -48,6 +48,18 @@ public:
   virtual std::shared_ptr<DHClient> dhclient() = 0;
   
   virtual uint16_t MTU() const = 0;
+
+  /** Whether the link can fill in L4 checksums for us */
+  virtual bool checksum_offload() const = 0;
+
+  /** Whether the link can cut large TCP segments into MTU sized ones */
+  virtual bool tso() const = 0;
+
+  /** Number of frames the link can take right now. 0 means it's full. */
+  virtual size_t transmit_queue_available() = 0;
+
+  /** Get called when the link can take more frames */
+  virtual void on_transmit_queue_available(transmit_avail_delg del) = 0;
   
   virtual Packet_ptr createPacket(size_t size) = 0;
   
@@ -71,22 +71,35 @@ namespace net {
 	@param size : the "size" reported by the allocated packet. 
 	@note as of v0.6.3 this has no effect other than to force the size to be
 	set explicitly by the caller. 
-	@todo make_shared will allocate with new. This is fast in IncludeOS,
-	(no context switch for sbrk) but consider overloading operator new.
+	@note the Packet itself comes from Packet::create's slab, not the heap.
     */
     inline Packet_ptr createPacket(size_t size) override {
       // Create a release delegate, for returning buffers
       auto release = BufferStore::release_del::from
 	<BufferStore, &BufferStore::release_offset_buffer>(nic_.bufstore());
+      auto buffer = bufstore_.get_offset_buffer();
+      if (not buffer)
+        panic("<Inet4> Buffer store exhausted, can't create packet.\n");
       // Create the packet, using  buffer and .
-      return std::make_shared<Packet>(bufstore_.get_offset_buffer(), 
-				      bufstore_.offset_bufsize(), size, release);
+      return Packet::create(buffer, bufstore_.offset_bufsize(), size, release);
     }
     
     // We have to ask the Nic for the MTU
     virtual inline uint16_t MTU() const override
     { return nic_.MTU(); }
 
+    virtual inline bool checksum_offload() const override
+    { return nic_.checksum_offload(); }
+
+    virtual inline bool tso() const override
+    { return nic_.tso(); }
+
+    virtual inline size_t transmit_queue_available() override
+    { return nic_.transmit_queue_available(); }
+
+    virtual inline void on_transmit_queue_available(transmit_avail_delg del) override
+    { nic_.on_transmit_queue_available(del); }
+
     inline auto available_capacity()
     { return bufstore_.capacity(); }
     
@@ -36,6 +36,9 @@ using Packet_ptr = std::shared_ptr<Packet>;
 using downstream = delegate<void(Packet_ptr)>;
 using upstream = downstream;
 
+// Called with the number of frames the link can take, once it can take more
+using transmit_avail_delg = delegate<void(size_t)>;
+
 // Compute the internet checksum for the buffer / buffer part provided
 uint16_t checksum(void* data, size_t len) noexcept;
 
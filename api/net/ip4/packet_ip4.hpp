@@ -77,10 +77,11 @@ private:
   /**
    *  Set IP4 header length
    *
-   *  Inferred from packet size and linklayer header size
+   *  Inferred from packet size (including any chained packets)
+   *  and linklayer header size
    */
   void set_segment_length() noexcept
-  { ip4_header().tot_len = htons(size() - sizeof(LinkLayer::header)); }
+  { ip4_header().tot_len = htons(chain_size() - sizeof(LinkLayer::header)); }
   
   void set_ip4_checksum() noexcept {
     auto& hdr = ip4_header();
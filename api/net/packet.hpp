@@ -26,6 +26,9 @@ namespace net {
 /** Default buffer release-function. Returns the buffer to Packet's bufferStore  **/
 void default_release(BufferStore::buffer_t, size_t);
 
+/** Release-function for buffers kept alive by the packet's owner. @see Packet::set_owner **/
+void no_release(BufferStore::buffer_t, size_t);
+
 class Packet : public std::enable_shared_from_this<Packet> {
 public:
   static constexpr size_t MTU {1500};
@@ -42,6 +45,16 @@ public:
    *  @WARNING: There are two adjacent parameters of the same type, violating CG I.24.
    */    
   Packet(BufferStore::buffer_t buf, size_t bufsize, size_t datalen, release_del d = default_release) noexcept;
+
+  /**
+   *  Create a packet using an existing buffer.
+   *
+   *  Same as std::make_shared<Packet>, except that the shared block
+   *  (refcounts and Packet) comes from a recycled slab instead of
+   *  the general heap. Prefer this on hot paths, like receiving frames.
+   */
+  static Packet_ptr create(BufferStore::buffer_t buf, size_t bufsize, size_t datalen,
+                           release_del d = default_release);
   
   /** Destruct. */
   virtual ~Packet();
@@ -68,6 +81,10 @@ public:
   
   /**
    *  Add a packet to this packet chain.
+   *
+   *  Chained packets continue this packet's payload, as one frame
+   *  (e.g. TSO / LRO segments): the bytes from buffer() to
+   *  buffer() + size() of each one follow on from the previous.
    * 
    *  @Warning: Let's hope this recursion won't smash the stack
    */
@@ -80,9 +97,17 @@ public:
    *  Get the next packet in the chain.
    *
    *  @Todo: Make chain iterators (i.e. begin / end) */
-  Packet_ptr unchain() noexcept
+  Packet_ptr unchain() const noexcept
   { return chain_; }
   
+  /**
+   *  Hold on to whatever keeps the buffer alive (e.g. the user's data for
+   *  a zero-copy write) for as long as the packet lives. Create the packet
+   *  with no_release, then there's nothing to allocate per buffer.
+   */
+  void set_owner(std::shared_ptr<const void> owner) noexcept
+  { owner_ = std::move(owner); }
+
   /** Get the the total number of packets in the chain */
   size_t chain_length() const noexcept {
     if (!chain_) {
@@ -91,6 +116,32 @@ public:
 
     return 1 + chain_->chain_length();
   }
+
+  /** Get the total number of bytes in the chain */
+  size_t chain_size() const noexcept {
+    size_t total = 0;
+    for (auto* p = this; p; p = p->chain_.get())
+      total += p->size_;
+    return total;
+  }
+
+  /**
+   *  Segmentation offload (TSO): The NIC cuts the payload following the
+   *  first @hdr_len bytes into @seg_size sized segments, each sent with
+   *  a copy of the headers. Requires set_csum_partial as well.
+   */
+  inline void set_gso(uint16_t seg_size, uint16_t hdr_len) noexcept {
+    gso_size_    = seg_size;
+    gso_hdr_len_ = hdr_len;
+  }
+
+  /** Segment size for segmentation offload. 0 means no segmentation */
+  inline uint16_t gso_size() const noexcept
+  { return gso_size_; }
+
+  /** Length of the headers to repeat in front of each segment */
+  inline uint16_t gso_hdr_len() const noexcept
+  { return gso_hdr_len_; }
   
   /**
    *  For a UDPv6 packet, the payload location is the start of
@@ -103,6 +154,37 @@ public:
   inline BufferStore::buffer_t payload() const noexcept
   { return payload_; }
   
+  /**
+   *  Checksum offload (TX): The L4 checksum from csum_start() to the
+   *  end of the packet is left to the NIC, and goes csum_offset() bytes
+   *  after csum_start(). Offsets are relative to buffer(). The checksum
+   *  field must hold the (uncomplemented) pseudo header sum.
+   */
+  inline void set_csum_partial(uint16_t start, uint16_t offset) noexcept {
+    csum_start_  = start;
+    csum_offset_ = offset;
+    offload_flags_ |= CSUM_PARTIAL;
+  }
+
+  inline bool csum_partial() const noexcept
+  { return offload_flags_ & CSUM_PARTIAL; }
+
+  inline uint16_t csum_start() const noexcept
+  { return csum_start_; }
+
+  inline uint16_t csum_offset() const noexcept
+  { return csum_offset_; }
+
+  /** Software fallback for a partial checksum, for NICs that can't offload */
+  void complete_checksum() noexcept;
+
+  /** Checksum offload (RX): The NIC has already verified the L4 checksum */
+  inline void set_csum_verified() noexcept
+  { offload_flags_ |= CSUM_VERIFIED; }
+
+  inline bool csum_verified() const noexcept
+  { return offload_flags_ & CSUM_VERIFIED; }
+
   /**
    *  Upcast back to normal packet
    *
@@ -120,12 +202,26 @@ protected:
   size_t                size_      {0};
   IP4::addr             next_hop4_ {};
 private:
+  enum offload_flag : uint8_t {
+    CSUM_PARTIAL  = 1 << 0,
+    CSUM_VERIFIED = 1 << 1
+  };
+
+  uint16_t              csum_start_    {0};
+  uint16_t              csum_offset_   {0};
+  uint16_t              gso_size_      {0};
+  uint16_t              gso_hdr_len_   {0};
+  uint8_t               offload_flags_ {0};
+
   /** Send the buffer back home, after destruction */
   release_del release_;
   
   /** Let's chain packets */
   Packet_ptr chain_ {};
 
+  /** Keeps a buffer that isn't ours alive, @see set_owner */
+  std::shared_ptr<const void> owner_ {};
+
   /** Default constructor Deleted. See Packet(Packet&). */
   Packet() = delete;
 
@@ -23,7 +23,10 @@
 #include <net/ip4/packet_ip4.hpp> // PacketIP4
 #include <net/util.hpp> // net::Packet_ptr, htons / noths
 #include <queue> // buffer
+#include <deque> // retransmission queue
+#include <vector> // read views
 #include <map>
+#include <utility/hash_table.hpp> // connections
 #include <sstream> // ostringstream
 #include <chrono> // timer duration
 #include <memory> // enable_shared_from_this
@@ -42,6 +45,9 @@ public:
 	using Packet_ptr = std::shared_ptr<Packet>;
 	class Connection;
 	using Connection_ptr = std::shared_ptr<Connection>;
+	class Congestion_control;
+	class NewReno;
+	class Cubic;
 	using IPStack = Inet<LinkLayer,IP4>;
 
 public:
@@ -109,6 +115,17 @@ public:
 	
 	static constexpr uint16_t default_window_size = 0xffff;
 
+	/* 
+		Largest IP datagram a TSO super segment may add up to.
+	*/
+	static constexpr uint32_t tso_max_size = 0xffff;
+
+	/*
+		Most buffers chained after the headers of one segment, written
+		without copying. Keeps a segment within one indirect descriptor table.
+	*/
+	static constexpr size_t max_chained_buffers = 16;
+
 	/* 
 		Flags (Control bits) in the TCP Header.
 	*/
@@ -124,6 +141,30 @@ public:
 		FIN 	= 1,			// Fin(ish)
     };
 
+	/*
+		Option kinds in the TCP Header.
+	*/
+	enum Option : uint8_t {
+		OPT_EOL 		= 0,	// End of option list
+		OPT_NOP 		= 1,	// No-Operation
+		OPT_MSS 		= 2,	// Maximum Segment Size (RFC 793)
+		OPT_WS 			= 3,	// Window Scale (RFC 7323)
+		OPT_SACK_PERM 	= 4,	// SACK Permitted (RFC 2018)
+		OPT_SACK 		= 5,	// SACK (RFC 2018)
+		OPT_TS 			= 8,	// Timestamps (RFC 7323)
+	};
+
+	/*
+		Largest TCP header, with options.
+	*/
+	static constexpr uint8_t max_header_size = 60;
+
+	/*
+		RFC 7323 (2.3) The shift count is at most 14, for a window of up to 1GB.
+	*/
+	static constexpr uint8_t max_window_shift = 14;
+	static constexpr uint32_t max_window_size = (uint32_t) default_window_size << max_window_shift;
+
     /*
 		Representation of the TCP Header.
 
@@ -325,13 +366,140 @@ public:
 
 		// Where data starts
 		inline char* data() { return (char*) (buffer() + all_headers_len()); }
-    	
-    	inline uint16_t data_length() const { return size() - all_headers_len(); }
+
+		// Where options start
+		inline uint8_t* options() const { return (uint8_t*) &header() + sizeof(TCP::Header); }
+
+		/*
+			Append an option, NOP padded in front to a multiple of 4 bytes.
+			Data has to be added after the options.
+		*/
+		void add_option(uint8_t kind, uint8_t length = 2, const void* value = nullptr) {
+			assert(!has_data());
+			const uint8_t pad = (4 - length % 4) % 4;
+			assert(header_size() + pad + length <= TCP::max_header_size);
+			uint8_t* opt = (uint8_t*) &header() + header_size();
+			memset(opt, OPT_NOP, pad);
+			opt[pad] = kind;
+			if(length > 1) {
+				opt[pad + 1] = length;
+				if(length > 2)
+					memcpy(opt + pad + 2, value, length - 2);
+			}
+			set_offset(offset() + (pad + length) / 4);
+			set_length(0);
+			set_payload(buffer() + all_headers_len());
+		}
+
+		/*
+			The first option of kind (pointing at the kind byte), or nullptr.
+		*/
+		const uint8_t* find_option(uint8_t kind) const {
+			const uint8_t* opt = options();
+			const uint8_t* end = (uint8_t*) &header() + header_size();
+			while(opt < end and *opt != OPT_EOL) {
+				if(*opt == kind)
+					return (opt + 1 < end and opt[1] >= 2 and opt + opt[1] <= end) ? opt : nullptr;
+				if(*opt == OPT_NOP) {
+					opt++;
+					continue;
+				}
+				if(opt + 1 >= end or opt[1] < 2)
+					break;
+				opt += opt[1];
+			}
+			return nullptr;
+		}
+
+		/*
+			TSval and TSecr of the Timestamps option (RFC 7323), if there is one.
+		*/
+		bool timestamps(uint32_t& val, uint32_t& ecr) const {
+			const uint8_t* opt = find_option(OPT_TS);
+			if(!opt or opt[1] != 10)
+				return false;
+			memcpy(&val, opt + 2, 4);
+			memcpy(&ecr, opt + 6, 4);
+			val = ntohl(val);
+			ecr = ntohl(ecr);
+			return true;
+		}
+
+		/*
+			Rewrite the Timestamps option in place. The packet has to have one.
+		*/
+		void set_timestamps(uint32_t val, uint32_t ecr) {
+			uint8_t* opt = (uint8_t*) find_option(OPT_TS);
+			assert(opt and opt[1] == 10);
+			val = htonl(val);
+			ecr = htonl(ecr);
+			memcpy(opt + 2, &val, 4);
+			memcpy(opt + 6, &ecr, 4);
+		}
+
+		/*
+			Drop the first n bytes of payload, and move SEQ past them.
+			For segments partly received already.
+		*/
+		void trim_front(size_t n) {
+			assert(n <= data_length());
+			set_seq(seq() + n);
+			const size_t own = buffer_data_length();
+			if(n < own) {
+				memmove(data(), data() + n, own - n);
+				set_length(own - n);
+				return;
+			}
+			set_length(0);
+			n -= own;
+			for(auto next = unchain(); next and n; next = next->unchain()) {
+				const size_t len = std::min<size_t>(n, next->size());
+				memmove(next->buffer(), next->buffer() + len, next->size() - len);
+				next->set_size(next->size() - len);
+				n -= len;
+			}
+		}
+
+    	// Payload in this packet's own buffer, from data()
+    	inline uint16_t buffer_data_length() const { return size() - all_headers_len(); }
+
+    	// Payload carried by chained packets (TSO / LRO segments)
+    	inline uint32_t chained_data_length() const { return chain_size() - size(); }
+
+    	// All the payload in the segment, chained packets included
+    	inline uint16_t data_length() const { return buffer_data_length() + chained_data_length(); }
 
     	inline bool has_data() const { return data_length() > 0; }
 
     	inline uint16_t tcp_length() const { return header_size() + data_length(); }
 
+    	/*
+    		Copy n bytes of payload, starting at offset, into dest.
+    		Walks through any chained packets. Returns the number of bytes copied.
+    	*/
+    	size_t copy_data(char* dest, size_t offset, size_t n) const {
+    		size_t copied = 0;
+    		// This packet's own payload, then each of the chained buffers
+    		const uint8_t* piece = buffer() + all_headers_len();
+    		size_t piece_len = buffer_data_length();
+    		auto next = unchain();
+    		while(copied < n) {
+    			if(offset < piece_len) {
+    				size_t len = std::min(piece_len - offset, n - copied);
+    				memcpy(dest + copied, piece + offset, len);
+    				copied += len;
+    				offset = 0;
+    			} else {
+    				offset -= piece_len;
+    			}
+    			if(!next) break;
+    			piece = next->buffer();
+    			piece_len = next->size();
+    			next = next->unchain();
+    		}
+    		return copied;
+    	}
+
     	
 
     	// sets the correct length for all the protocols up to IP4
@@ -344,12 +512,12 @@ public:
 	    //! this will fill bytes from @buffer into this packets buffer,
 	    //! then return the number of bytes written. buffer is unmodified
     	size_t fill(const char* buffer, size_t length) {
-    		size_t rem = capacity() - all_headers_len();
+    		size_t rem = capacity() - all_headers_len() - buffer_data_length();
     		size_t total = (length < rem) ? length : rem;
       		// copy from buffer to packet buffer
-    		memcpy(data() + data_length(), buffer, total);
+    		memcpy(data() + buffer_data_length(), buffer, total);
       		// set new packet length
-    		set_length(data_length() + total);
+    		set_length(buffer_data_length() + total);
     		return total;
     	}
 
@@ -448,6 +616,24 @@ public:
 		*/
 		using Tuple = std::pair<TCP::Port, TCP::Socket>;
 
+		/*
+			Hash of the connection identifier, mixing all bits of
+			local port, remote address and remote port.
+		*/
+		struct Tuple_hash {
+			size_t operator()(const Tuple& tuple) const {
+				uint32_t h = tuple.second.address().whole
+					^ ((uint32_t)tuple.second.port() << 16 | tuple.first);
+				// Murmur3 finalizer
+				h ^= h >> 16;
+				h *= 0x85ebca6b;
+				h ^= h >> 13;
+				h *= 0xc2b2ae35;
+				h ^= h >> 16;
+				return h;
+			}
+		};
+
 		/// CALLBACKS ///
 		/*
 			On connection attempt - When a remote sends SYN to connection in LISTENING state.
@@ -496,6 +682,18 @@ public:
 		*/
 		using Buffer = PacketBuffer<>;
 
+		/*
+			A piece of data to send without copying it. Segments point right
+			into it, so it's referred to until acknowledged. owner is held on to
+			until then - leave it empty if the data outlives the connection anyway.
+		*/
+		struct Slice {
+			const void* data;
+			size_t length;
+			std::shared_ptr<const void> owner;
+		};
+		using Slices = std::vector<Slice>;
+
 		/*
 			Interface for one of the many states a Connection can have.
 		*/
@@ -518,6 +716,12 @@ public:
 			*/
 			virtual size_t send(Connection&, const char* buffer, size_t n, bool push = false);
 
+			/*
+				Write to a Connection, without copying.
+				SEND
+			*/
+			virtual size_t send(Connection&, const Slices& slices, bool push = false);
+
 			/*
 				Read from a Connection.
 				RECEIVE
@@ -600,26 +804,46 @@ public:
 			struct {
 				TCP::Seq UNA;	// send unacknowledged
 				TCP::Seq NXT;	// send next
-				uint16_t WND;	// send window
+				uint32_t WND;	// send window
 				uint16_t UP;	// send urgent pointer
 				TCP::Seq WL1;	// segment sequence number used for last window update
 				TCP::Seq WL2;	// segment acknowledgment number used for last window update
+				uint16_t MSS;	// largest segment the other end takes
+				uint8_t WS;		// shift of the other end's window (Snd.Wind.Shift)
 			} SND; // <<
 			TCP::Seq ISS;		// initial send sequence number
 
 			/* Receive Sequence Variables */
 			struct {
 				TCP::Seq NXT;	// receive next
-				uint16_t WND;	// receive window
+				uint32_t WND;	// receive window
 				uint16_t UP;	// receive urgent pointer
+				uint8_t WS;		// shift of our window (Rcv.Wind.Shift)
 			} RCV; // <<
 			TCP::Seq IRS;		// initial receive sequence number
 
+			/* Round-trip time estimation (RFC 6298), in milliseconds */
+			struct {
+				double SRTT;	// smoothed round-trip time, 0 until measured
+				double RTTVAR;	// round-trip time variation
+				uint32_t RTO;	// retransmission timeout, with any backoff
+			} RTT; // <<
+
+			/* Timestamps (RFC 7323) */
+			struct {
+				bool OK;				// both ends sent the option (Snd.TS.OK)
+				uint32_t RECENT;		// TSval to echo (TS.Recent)
+				TCP::Seq LAST_ACK_SENT;	// ACK of our last segment (Last.ACK.sent)
+			} TS; // <<
+
 			TCB() {
-				SND = { 0, 0, TCP::default_window_size, 0, 0, 0 };
+				// RFC 1122 (4.2.2.6) Without the MSS option, 536 is assumed
+				SND = { 0, 0, TCP::default_window_size, 0, 0, 0, 536, 0 };
 				ISS = 0;
-				RCV = { 0, TCP::default_window_size, 0 };
+				RCV = { 0, TCP::default_window_size, 0, 0 };
 				IRS = 0;
+				RTT = { 0, 0, 1000 }; // RFC 6298 (2.1): Initially 1 second
+				TS = { false, 0, 0 };
 			};
 
 			std::string to_string() const;
@@ -668,11 +892,47 @@ public:
 		*/
 		std::string read(size_t n = 0);
 
+		/*
+			A read-only view of received data, right in a packet buffer.
+			Holds on to the packet; the buffer goes back to the BufferStore
+			when the last view into it is gone.
+		*/
+		class View {
+		public:
+			View(const uint8_t* data, size_t length, net::Packet_ptr packet)
+				: data_(data), length_(length), packet_(std::move(packet)) {}
+
+			inline const uint8_t* data() const { return data_; }
+
+			inline size_t size() const { return length_; }
+
+			inline std::string to_string() const { return {(const char*) data_, length_}; }
+
+		private:
+			const uint8_t* data_;
+			size_t length_;
+			net::Packet_ptr packet_;
+		};
+		using Views = std::vector<View>;
+
+		/*
+			Read up to n bytes (0 for everything received) without copying.
+			One view per packet buffer, in order.
+		*/
+		Views read_views(size_t n = 0);
+
 		/*
 			Write content to remote.
 		*/
 		size_t write(const char* buffer, size_t n, bool PUSH = true);
 
+		/*
+			Write content to remote without copying it, in as few segments as
+			the MSS (or TSO) allows. Returns the number of bytes written; the
+			rest didn't fit in the send buffer.
+		*/
+		size_t write(const Slices& slices, bool PUSH = true);
+
 		/*
 			Write a string to the remote.
 		*/
@@ -834,6 +1094,88 @@ public:
 			return state_->to_string() == state_str;
 		}
 
+		/*
+			Current retransmission timeout.
+		*/
+		std::chrono::milliseconds RTO() const;
+
+		/*
+			Smoothed round-trip time. 0 until measured.
+		*/
+		inline double SRTT() const { return control_block.RTT.SRTT; }
+
+		/*
+			Number of segments retransmitted on timeout.
+		*/
+		inline uint32_t retransmissions() const { return retransmissions_; }
+
+		/*
+			Number of segments sent, but not yet acknowledged.
+		*/
+		inline size_t unacknowledged() const { return rt_queue_.size(); }
+
+		/*
+			Octets sent, but not yet acknowledged.
+		*/
+		uint32_t flight_size() const;
+
+		/*
+			Number of segments waiting for room in the congestion or send window.
+		*/
+		inline size_t send_queue_size() const { return send_queue_.size(); }
+
+		/*
+			Number of segments retransmitted on three duplicate ACKs.
+		*/
+		inline uint32_t fast_retransmits() const { return fast_retransmits_; }
+
+		/*
+			Number of segments received out of order, waiting for the gaps before them.
+		*/
+		inline size_t ooo_queue_size() const { return ooo_queue_.size(); }
+
+		/*
+			Number of data segments acknowledged by a later ACK instead of their own.
+		*/
+		inline uint32_t acks_coalesced() const { return acks_coalesced_; }
+
+		/*
+			Number of data segments acknowledged along with data we sent.
+		*/
+		inline uint32_t acks_piggybacked() const { return acks_piggybacked_; }
+
+		/*
+			Whether SACK was negotiated for this connection.
+		*/
+		inline bool sack_permitted() const { return sack_permitted_; }
+
+		/*
+			Whether Window Scale was negotiated for this connection.
+		*/
+		inline bool window_scaling() const { return window_scaling_; }
+
+		/*
+			Whether Timestamps were negotiated for this connection.
+		*/
+		inline bool timestamps() const { return control_block.TS.OK; }
+
+		/*
+			Sender maximum segment size: what the other end takes, less the
+			options on every segment.
+		*/
+		uint16_t SMSS() const;
+
+		/*
+			The congestion control algorithm. NewReno by default.
+		*/
+		inline Congestion_control& congestion_control() const { return *congestion_; }
+
+		/*
+			Use another congestion control algorithm, starting over from the initial window.
+			Set on a listener, every connection accepted gets its own of the same kind.
+		*/
+		Connection& set_congestion_control(std::shared_ptr<Congestion_control>);
+
 		/*
 			Destroy the Connection.
 
@@ -873,9 +1215,96 @@ public:
 		Buffer send_buffer_;
 
 		/*
-			When time-wait timer was started.
+			The running time-wait timer, if any.
+		*/
+		hw::PIT::timer_id time_wait_timer_;
+
+		/*
+			Retransmission queue. Segments taking up sequence space
+			that are sent, but not yet acknowledged. Oldest first.
+			Segments the receiver has reported in SACK blocks are marked,
+			and not retransmitted before the holes between them.
+		*/
+		struct Rt_entry {
+			TCP::Packet_ptr packet;
+			bool sacked;
+		};
+		std::deque<Rt_entry> rt_queue_;
+
+		/*
+			The running retransmission timer, if any.
 		*/
-		uint64_t time_wait_started;
+		hw::PIT::timer_id rtx_timer_;
+
+		/*
+			Round-trip time measurement. One segment at a time is timed,
+			and never a retransmitted one (Karn's algorithm).
+		*/
+		bool rtt_active_;
+		TCP::Seq rtt_seq_;		// ACK that completes the measurement
+		uint64_t rtt_start_;	// cycles
+
+		/*
+			Segments retransmitted on timeout.
+		*/
+		uint32_t retransmissions_;
+
+		/*
+			Segments taking up sequence space that don't fit in the
+			congestion or send window yet. Sent as ACKs make room.
+		*/
+		std::deque<TCP::Packet_ptr> send_queue_;
+
+		/*
+			Congestion window and slow start threshold, with the algorithm updating them.
+		*/
+		std::shared_ptr<Congestion_control> congestion_;
+
+		/*
+			Fast retransmit / fast recovery (RFC 5681, RFC 6582).
+		*/
+		uint32_t dup_acks_;
+		bool fast_recovery_;
+		TCP::Seq recover_;		// highest sequence number sent when loss was detected
+		uint32_t fast_retransmits_;
+
+		/*
+			Segments received ahead of RCV.NXT, sorted by sequence number,
+			without overlap. Delivered to the receive buffer as the gaps fill.
+		*/
+		std::deque<TCP::Packet_ptr> ooo_queue_;
+
+		/*
+			Start of the segment last added to the out-of-order queue.
+			Reported first in SACK blocks.
+		*/
+		TCP::Seq ooo_last_;
+
+		/*
+			Both ends sent SACK Permitted (RFC 2018).
+		*/
+		bool sack_permitted_;
+
+		/*
+			Both ends sent Window Scale (RFC 7323).
+		*/
+		bool window_scaling_;
+
+		/*
+			Delayed ACK (RFC 1122 4.2.3.2, RFC 5681 4.2): data received and
+			not yet acknowledged, and the timer to acknowledge it by.
+		*/
+		hw::PIT::timer_id delack_timer_;
+		uint32_t delack_segments_;
+		uint32_t delack_bytes_;
+		uint32_t acks_coalesced_;
+		uint32_t acks_piggybacked_;
+
+		/*
+			Right edge of the receive window last advertised, RCV.NXT + RCV.WND.
+			Never moved left.
+		*/
+		TCP::Seq rcv_edge_;
 
 		
 		/// CALLBACK HANDLING ///
@@ -980,11 +1409,106 @@ public:
 		*/
 		size_t write_to_send_buffer(const char* buffer, size_t n, bool PUSH = true);
 
+		/*
+			Segment the slices into the send buffer, chaining packets that point
+			into them after the headers. Returns the number of bytes written.
+		*/
+		size_t write_to_send_buffer(const Slices& slices, bool PUSH = true);
+
+		/*
+			Append payload to a full packet as chained buffers, making it a TSO super segment.
+			Returns the number of bytes appended.
+		*/
+		size_t append_tso_payload(TCP::Packet_ptr, const char* buffer, size_t n);
+
 		/*
 			Transmit the send buffer.
+			Segments with data wait in the send queue, unless the window has room.
 		*/
 		void transmit();
 
+		/*
+			Transmit from the send queue as long as the window has room.
+		*/
+		void transmit_queued();
+
+		/*
+			Whether the packet fits in what's left of the congestion and send window.
+		*/
+		bool can_send(TCP::Packet&) const;
+
+		/*
+			Add the options for an outgoing segment: MSS, Window Scale, SACK Permitted
+			and Timestamps on SYN, SACK blocks on pure ACKs while segments are held
+			out of order.
+		*/
+		void add_options(TCP::Packet&);
+
+		/*
+			Read the options of the other end's SYN.
+		*/
+		void parse_syn_options(TCP::Packet&);
+
+		/*
+			Fresh TSval, and TS.Recent echoed, on a segment about to be sent.
+		*/
+		void stamp(TCP::Packet&);
+
+		/*
+			RFC 7323 (5.3) PAWS: Whether the segment is older than TS.Recent.
+		*/
+		bool paws_reject(TCP::Packet&) const;
+
+		/*
+			Remember the TSval of an acceptable segment, to echo it.
+		*/
+		void update_ts_recent(TCP::Packet&);
+
+		/*
+			The window in an incoming segment, scaled. The window in a SYN never is.
+		*/
+		uint32_t segment_window(TCP::Packet&) const;
+
+		/*
+			Room in the receive buffer, in octets. At most the window size.
+		*/
+		uint32_t receive_room() const;
+
+		/*
+			The largest window ever offered: an empty receive buffer.
+		*/
+		uint32_t max_receive_window() const;
+
+		/*
+			Set RCV.WND from the room in the receive buffer, without shrinking it.
+		*/
+		void update_receive_window();
+
+		/*
+			Data was read out of the receive buffer. Send a window update if
+			the other end is waiting for room.
+		*/
+		void receive_window_opened();
+
+		/// OUT OF ORDER ///
+
+		/*
+			Hold a segment starting after RCV.NXT until the gap before it is filled.
+			Returns false if there's no room for it.
+		*/
+		bool ooo_insert(TCP::Packet_ptr);
+
+		/*
+			Move held segments that are now in order to the receive buffer, and
+			advance RCV.NXT over them. Returns whether any of them carried PUSH.
+		*/
+		bool ooo_deliver();
+
+		/*
+			Mark the segments covered by the SACK blocks of an incoming ACK.
+		*/
+		void sack_acknowledge(TCP::Packet&);
+
 		/*
 			Transmit the packet.
 		*/
@@ -1005,21 +1529,75 @@ public:
 	 	/// RETRANSMISSION ///
 
 	 	/*
-	 		Starts a retransmission timer that retransmits the packet when RTO has passed.
-	 		
-	 		// TODO: Calculate RTO, currently hardcoded to 1 second (1000ms).
+	 		Put the packet in the retransmission queue, and make sure the
+	 		retransmission timer is running. Times it, if nothing else is.
 	 	*/
 	 	void add_retransmission(TCP::Packet_ptr);
 
+	 	/*
+	 		SND.UNA has advanced by acked octets. Remove what's fully acknowledged
+	 		from the retransmission queue, take an RTT sample from the echoed
+	 		timestamp or if the timed segment is covered, and let congestion
+	 		control know.
+	 	*/
+	 	void rt_acknowledge(TCP::Packet&, uint32_t acked);
+
+	 	/*
+	 		A duplicate ACK. The third one in a row means a segment is lost:
+	 		retransmit it without waiting for the timer, and enter fast recovery.
+	 	*/
+	 	void dup_acknowledge();
+
+	 	/*
+	 		Send the oldest unacknowledged segment again, skipping
+	 		those the receiver has SACKed.
+	 	*/
+	 	void retransmit();
+
+	 	/*
+	 		The retransmission timer went off. Back off, and send the
+	 		oldest unacknowledged segment again.
+	 	*/
+	 	void rtx_timeout();
+
+	 	/*
+	 		Start the retransmission timer with the current RTO, unless
+	 		it's running. Or restart it.
+	 	*/
+	 	void rtx_start();
+	 	void rtx_restart();
+	 	void rtx_stop();
+
+	 	/*
+	 		A data segment of length octets has been taken in, and is to be acknowledged.
+	 	*/
+	 	void delack_add(uint32_t length);
+
+	 	/*
+	 		Acknowledge what's received now if it's urgent, two full segments or
+	 		more, or delayed ACKs are off. Otherwise when the timer goes off -
+	 		or along with whatever is sent before that.
+	 	*/
+	 	void delack_check(bool immediate);
+
+	 	/*
+	 		An ACK is going out. Nothing pending if it covers RCV.NXT.
+	 	*/
+	 	void delack_sent(TCP::Packet&);
+
+	 	void delack_timeout();
+	 	void delack_stop();
+
 	 	/*
 			Measure the elapsed time between sending a data octet with a
       		particular sequence number and receiving an acknowledgment that
       		covers that sequence number (segments sent do not have to match
       		segments received).  This measured elapsed time is the Round Trip
       		Time (RTT).
+
+      		Update SRTT, RTTVAR and RTO with a new RTT sample (in milliseconds).
 	 	*/
-	 	//std::chrono::milliseconds RTT() const;
-  		std::chrono::milliseconds RTO() const;
+	 	void rtt_measure(double rtt);
 
 	 	void start_time_wait_timeout();
 
@@ -1072,6 +1650,12 @@ public:
 	*/
     static uint16_t checksum(const TCP::Packet_ptr);
 
+	/*
+		Sum of the TCP pseudo header, folded but not complemented.
+		This is what the checksum field holds when the NIC completes the checksum.
+	*/
+	static uint16_t pseudo_header_sum(const TCP::Packet_ptr);
+
     inline const auto& listeners() { return listeners_; }
 
     inline const auto& connections() { return connections_; }
@@ -1098,6 +1682,70 @@ public:
 		MAX_SEG_LIFETIME = msl;
 	}
 
+	/*
+		Lower bound for the retransmission timeout
+	*/
+	inline auto min_RTO() const { return MIN_RTO; }
+
+	/*
+		Set lower bound for the retransmission timeout.
+		RFC 6298 says 1s, but on a LAN that's ages.
+	*/
+	inline void set_min_RTO(const std::chrono::milliseconds rto) {
+		MIN_RTO = rto;
+	}
+
+	/*
+		Whether SACK Permitted is offered to the other end.
+	*/
+	inline bool sack() const { return SACK; }
+
+	/*
+		Offer (or not) SACK to new connections.
+	*/
+	inline void set_sack(bool sack) { SACK = sack; }
+
+	/*
+		How long an ACK may be delayed, waiting for a second segment or data
+		to go along with. 0 acknowledges every segment right away.
+	*/
+	inline auto delayed_ack() const { return DELAYED_ACK; }
+
+	/*
+		Set the delayed ACK timeout. RFC 1122 says less than 0.5 seconds.
+	*/
+	inline void set_delayed_ack(const std::chrono::milliseconds timeout) {
+		DELAYED_ACK = timeout;
+	}
+
+	/*
+		Whether Timestamps are offered to the other end.
+	*/
+	inline bool timestamps() const { return TIMESTAMPS; }
+
+	/*
+		Offer (or not) Timestamps to new connections.
+	*/
+	inline void set_timestamps(bool ts) { TIMESTAMPS = ts; }
+
+	/*
+		Receive window of new connections, in octets. Beyond 64KB it is
+		scaled (RFC 7323), if the other end does Window Scale.
+	*/
+	inline uint32_t window_size() const { return WINDOW_SIZE; }
+
+	/*
+		Set the receive window of new connections. At most 1GB.
+	*/
+	inline void set_window_size(uint32_t size) {
+		WINDOW_SIZE = (size < max_window_size) ? size : max_window_size;
+	}
+
+	/*
+		The MSS we take: the largest segment that fits the link MTU (1460).
+	*/
+	uint16_t MSS() const;
+
 	/*
 		Maximum Buffer Size
 	*/
@@ -1119,7 +1767,10 @@ public:
 private:
 	IPStack& inet_;
 	std::map<TCP::Port, Connection> listeners_;
-	std::map<Connection::Tuple, Connection_ptr> connections_;
+	/*
+		Demux of incoming segments. Hashed, as there may be thousands.
+	*/
+	HashTable<Connection::Tuple, Connection_ptr, Connection::Tuple_hash> connections_;
 
 	downstream _network_layer_out;
 
@@ -1130,6 +1781,16 @@ private:
 
 	std::chrono::milliseconds MAX_SEG_LIFETIME;
 
+	std::chrono::milliseconds MIN_RTO;
+
+	std::chrono::milliseconds DELAYED_ACK;
+
+	bool SACK;
+
+	bool TIMESTAMPS;
+
+	uint32_t WINDOW_SIZE;
+
 	/*
 		Current: limit by packet COUNT.
 		Connection buffer size in bytes = buffers * BUFFER_LIMIT * MTU.
@@ -0,0 +1,179 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015-2016 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NET_TCP_CONGESTION_HPP
+#define NET_TCP_CONGESTION_HPP
+
+#include <net/tcp.hpp>
+
+namespace net {
+
+/*
+	Congestion control for one Connection.
+
+	Keeps the congestion window (cwnd) and slow start threshold (ssthresh),
+	in octets. The Connection detects the events - new data acknowledged,
+	duplicate ACKs, partial ACKs in fast recovery and timeouts (RFC 5681, 6582),
+	and the algorithm decides what they do to the window.
+
+	An algorithm only decides how the window grows in congestion avoidance,
+	and how much it shrinks on loss.
+*/
+class TCP::Congestion_control {
+public:
+	virtual ~Congestion_control() = default;
+
+	virtual const char* name() const = 0;
+
+	/*
+		A fresh instance of the same algorithm, for a new connection.
+	*/
+	virtual std::shared_ptr<Congestion_control> clone() const = 0;
+
+	/*
+		Start over with the initial window (RFC 5681 3.1) for the given
+		sender maximum segment size.
+	*/
+	virtual void init(uint32_t smss);
+
+	inline uint32_t cwnd() const { return cwnd_; }
+
+	inline uint32_t ssthresh() const { return ssthresh_; }
+
+	inline uint32_t smss() const { return smss_; }
+
+	inline bool slow_start() const { return cwnd_ < ssthresh_; }
+
+	/*
+		New data acknowledged, outside of fast recovery.
+		srtt is the smoothed round-trip time in milliseconds, 0 if unknown.
+	*/
+	void on_ack(uint32_t acked, double srtt);
+
+	/*
+		Third duplicate ACK. The segment is retransmitted, and fast recovery entered.
+	*/
+	void on_fast_retransmit(uint32_t flight);
+
+	/*
+		Additional duplicate ACK in fast recovery. A segment has left the network.
+	*/
+	void on_dup_ack();
+
+	/*
+		ACK of some, but not all, of what was outstanding when fast recovery started.
+	*/
+	void on_partial_ack(uint32_t acked);
+
+	/*
+		Everything outstanding when fast recovery started is acknowledged.
+	*/
+	void on_recovery_exit(uint32_t flight);
+
+	/*
+		The retransmission timer expired.
+	*/
+	void on_timeout(uint32_t flight);
+
+protected:
+	/*
+		The slow start threshold after a loss.
+	*/
+	virtual uint32_t loss_ssthresh(uint32_t flight) = 0;
+
+	/*
+		Grow the window in congestion avoidance.
+	*/
+	virtual void congestion_avoidance(uint32_t acked, double srtt) = 0;
+
+	/* Keep clear of overflow on very long transfers */
+	static const uint32_t max_cwnd = 1 << 30;
+
+	uint32_t smss_ = 536;
+	uint32_t cwnd_ = 0;
+	uint32_t ssthresh_ = 0;
+
+}; // << TCP::Congestion_control
+
+/*
+	NewReno (RFC 5681, RFC 6582).
+
+	Congestion avoidance grows cwnd by one segment per window of data
+	acknowledged, and a loss halves what was in flight.
+*/
+class TCP::NewReno : public TCP::Congestion_control {
+public:
+	virtual const char* name() const override { return "NewReno"; }
+
+	virtual std::shared_ptr<Congestion_control> clone() const override;
+
+	virtual void init(uint32_t smss) override;
+
+protected:
+	virtual uint32_t loss_ssthresh(uint32_t flight) override;
+
+	virtual void congestion_avoidance(uint32_t acked, double srtt) override;
+
+private:
+	/* Octets acknowledged since cwnd last grew */
+	uint32_t bytes_acked_ = 0;
+
+}; // << TCP::NewReno
+
+/*
+	CUBIC (RFC 8312).
+
+	The window grows as a cubic function of the time since the last loss,
+	centered on the window where it happened (W_max). It climbs back fast,
+	flattens out around W_max, then probes beyond it - independent of RTT,
+	so long fat paths fill up. Never slower than what Reno would do.
+*/
+class TCP::Cubic : public TCP::Congestion_control {
+public:
+	virtual const char* name() const override { return "CUBIC"; }
+
+	virtual std::shared_ptr<Congestion_control> clone() const override;
+
+	virtual void init(uint32_t smss) override;
+
+protected:
+	virtual uint32_t loss_ssthresh(uint32_t flight) override;
+
+	virtual void congestion_avoidance(uint32_t acked, double srtt) override;
+
+private:
+	static constexpr double C = 0.4;
+	static constexpr double BETA = 0.7;
+
+	/* Window before the last reduction, in segments */
+	double w_max_ = 0;
+	/* Time for the cubic function to get back to w_max_, in seconds */
+	double k_ = 0;
+	/* Where the cubic function plateaus, in segments */
+	double origin_ = 0;
+	/* What Reno would have by now, in segments */
+	double w_est_ = 0;
+	/* Start of the current congestion avoidance epoch, in ms. 0 when not started */
+	uint64_t epoch_start_ = 0;
+	/* Growth not yet added to cwnd, in octets */
+	double pending_ = 0;
+
+}; // << TCP::Cubic
+
+}; // < namespace net
+
+#endif
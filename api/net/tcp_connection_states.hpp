@@ -23,6 +23,7 @@
 using TCP = net::TCP;
 using Connection = TCP::Connection;
 using State = TCP::Connection::State;
+using Slices = TCP::Connection::Slices;
 
 /*
 	CLOSED
@@ -38,6 +39,8 @@ public:
 
 	virtual size_t send(Connection&, const char* buffer, size_t n, bool push) override;
 
+	virtual size_t send(Connection&, const Slices& slices, bool push) override;
+
 	/*
 		PASSIVE:		
 		<- Do nothing (Start listening).
@@ -71,6 +74,8 @@ public:
 
 	virtual size_t send(Connection&, const char* buffer, size_t n, bool push) override;
 
+	virtual size_t send(Connection&, const Slices& slices, bool push) override;
+
 	virtual void close(Connection&) override;
 	/*
 		-> Receive SYN.
@@ -100,6 +105,8 @@ public:
 
 	virtual size_t send(Connection&, const char* buffer, size_t n, bool push) override;
 
+	virtual size_t send(Connection&, const Slices& slices, bool push) override;
+
 	virtual void close(Connection&) override;
 	/*
 		-> Receive SYN+ACK
@@ -129,6 +136,8 @@ public:
 
 	virtual size_t send(Connection&, const char* buffer, size_t n, bool push) override;
 
+	virtual size_t send(Connection&, const Slices& slices, bool push) override;
+
 	virtual void close(Connection&) override;
 
 	virtual void abort(Connection&) override;
@@ -161,6 +170,8 @@ public:
 
 	virtual size_t send(Connection&, const char* buffer, size_t n, bool push) override;
 
+	virtual size_t send(Connection&, const Slices& slices, bool push) override;
+
 	virtual size_t receive(Connection&, char* buffer, size_t n) override;
 
 	virtual void close(Connection&) override;
@@ -247,6 +258,8 @@ public:
 
 	virtual size_t send(Connection&, const char* buffer, size_t n, bool push) override;
 
+	virtual size_t send(Connection&, const Slices& slices, bool push) override;
+
 	virtual size_t receive(Connection&, char* buffer, size_t n) override;
 
 	virtual void close(Connection&) override;
@@ -0,0 +1,200 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#include <stddef.h>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/**
+ *  Open addressing hash table, with linear probing
+ *
+ *  Keys and values are stored right in one flat array, so a lookup is a
+ *  hash and (most of the time) one cache line, rather than a tree walk.
+ *  Erasing shifts the rest of the cluster back instead of leaving
+ *  tombstones, so lookups don't get slower with churn.
+ *
+ *  The slot of the last hit is remembered and checked first, since
+ *  lookups tend to come in runs for the same key.
+ *
+ *  @note: Entries move on insert and erase - don't hold on to pointers
+ *         returned by find / emplace across those.
+ *  @note: Key and T must be default constructible.
+ */
+template <typename Key, typename T, typename Hash = std::hash<Key>>
+class HashTable {
+  struct Slot {
+    std::pair<Key, T> kv;
+    bool used = false;
+  };
+
+  template <typename Table, typename Value>
+  class basic_iterator {
+  public:
+    basic_iterator(Table& table, size_t i) : table_(table), i_(i)
+    { skip(); }
+
+    Value& operator* () const { return table_.slots_[i_].kv; }
+    Value* operator->() const { return &table_.slots_[i_].kv; }
+
+    basic_iterator& operator++ ()
+    { i_++; skip(); return *this; }
+
+    bool operator!= (const basic_iterator& other) const
+    { return i_ != other.i_; }
+
+  private:
+    Table& table_;
+    size_t i_;
+
+    void skip()
+    { while (i_ < table_.slots_.size() and not table_.slots_[i_].used) i_++; }
+  };
+
+public:
+  using value_type     = std::pair<Key, T>;
+  using iterator       = basic_iterator<HashTable, value_type>;
+  using const_iterator = basic_iterator<const HashTable, const value_type>;
+
+  /** @param capacity: Slots to start with. Rounded up to a power of 2. */
+  explicit HashTable(size_t capacity = 16)
+  { rehash(capacity); }
+
+  /** @return The value for key, or nullptr if there is none */
+  T* find(const Key& key) {
+    if (last_ < slots_.size() and slots_[last_].used
+        and slots_[last_].kv.first == key)
+      return &slots_[last_].kv.second;
+
+    for (size_t i = home(key); slots_[i].used; i = next(i)) {
+      if (slots_[i].kv.first == key) {
+        last_ = i;
+        return &slots_[i].kv.second;
+      }
+    }
+    return nullptr;
+  }
+
+  /** Insert value for key, unless key is already there.
+      @return The value for key, and whether it was inserted */
+  std::pair<T*, bool> emplace(const Key& key, T value) {
+    if (auto* found = find(key))
+      return {found, false};
+
+    // Keep the load at 1/2 or below; probe sequences stay short
+    if ((size_ + 1) * 2 > slots_.size())
+      rehash(slots_.size() * 2);
+
+    size_t i = home(key);
+    while (slots_[i].used)
+      i = next(i);
+
+    slots_[i].kv = value_type{key, std::move(value)};
+    slots_[i].used = true;
+    size_++;
+    last_ = i;
+    return {&slots_[i].kv.second, true};
+  }
+
+  /** Remove key, if it's there. @return Whether it was */
+  bool erase(const Key& key) {
+    size_t hole = home(key);
+    while (slots_[hole].used and not (slots_[hole].kv.first == key))
+      hole = next(hole);
+
+    if (not slots_[hole].used)
+      return false;
+
+    // Move back every later entry of the cluster that may live in the hole,
+    // i.e. that passed the hole on its way from its home slot
+    for (size_t i = next(hole); slots_[i].used; i = next(i)) {
+      size_t home_i = home(slots_[i].kv.first);
+      if (((i - home_i) & mask_) >= ((i - hole) & mask_)) {
+        slots_[hole].kv = std::move(slots_[i].kv);
+        hole = i;
+      }
+    }
+
+    // Let go of the value now, not when the slot is reused
+    slots_[hole].kv = value_type();
+    slots_[hole].used = false;
+    size_--;
+    last_ = npos;
+    return true;
+  }
+
+  void clear() {
+    for (auto& slot : slots_)
+      slot = Slot();
+    size_ = 0;
+    last_ = npos;
+  }
+
+  inline size_t size() const noexcept
+  { return size_; }
+
+  inline bool empty() const noexcept
+  { return size_ == 0; }
+
+  inline size_t capacity() const noexcept
+  { return slots_.size(); }
+
+  iterator begin() { return {*this, 0}; }
+  iterator end()   { return {*this, slots_.size()}; }
+  const_iterator begin() const { return {*this, 0}; }
+  const_iterator end()   const { return {*this, slots_.size()}; }
+
+private:
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  std::vector<Slot> slots_;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+  size_t last_ = npos;
+  Hash hash_;
+
+  inline size_t home(const Key& key) const
+  { return hash_(key) & mask_; }
+
+  inline size_t next(size_t i) const
+  { return (i + 1) & mask_; }
+
+  void rehash(size_t capacity) {
+    size_t n = 8;
+    while (n < capacity)
+      n *= 2;
+
+    std::vector<Slot> old(n);
+    old.swap(slots_);
+    mask_ = n - 1;
+    last_ = npos;
+
+    for (auto& slot : old) {
+      if (not slot.used)
+        continue;
+      size_t i = home(slot.kv.first);
+      while (slots_[i].used)
+        i = next(i);
+      slots_[i].kv = std::move(slot.kv);
+      slots_[i].used = true;
+    }
+  }
+
+  friend iterator;
+  friend const_iterator;
+}; // < class HashTable
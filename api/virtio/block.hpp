@@ -20,12 +20,22 @@
 #define VIRTIO_BLOCK_HPP
 
 #include <common>
+#include <deque>
+#include <vector>
 #include <hw/disk_device.hpp>
 #include <hw/pci_device.hpp>
 #include "virtio.hpp"
 //#include <delegate>
 
-/** Virtio-net device driver.  */
+/**
+ *  Virtio-blk device driver.
+ *
+ *  Reads and writes of any number of sectors go to the device as few
+ *  requests as SEG_MAX / SIZE_MAX allow, each as one indirect descriptor
+ *  chain, and the device transfers straight into (or out of) the caller's
+ *  buffer. Requests that don't fit in the ring wait in a queue, so as many
+ *  are in flight as the device takes.
+ */
 class VirtioBlk : public Virtio, public hw::IDiskDevice
 {
 public:
@@ -43,20 +53,42 @@ public:
     return SECTOR_SIZE; // some multiple of sector size
   }
   
-  virtual void read(block_t blk, on_read_func func) override;
-  
-  virtual void read(block_t, block_t, on_read_func cb) override
+  virtual void read(block_t blk, on_read_func func) override
   {
-    cb(buffer_t());
+    read(blk, 1, func);
   }
   
+  virtual void read(block_t blk, block_t count, on_read_func func) override;
+  
+  /** Read count sectors into buf, which has room for them */
+  void read(block_t blk, block_t count, buffer_t buf, on_read_func func);
+  
   virtual buffer_t read_sync(block_t blk) override;
   
+  virtual void write(block_t blk, block_t count, buffer_t buf, on_write_func func) override;
+  
+  virtual void flush(on_write_func func) override;
+  
   virtual block_t size() const noexcept override
   {
     return config.capacity;
   }
   
+  /** Whether the device only takes reads (VIRTIO_BLK_F_RO) */
+  bool read_only() const noexcept;
+  
+  /** Most sectors in one device request */
+  inline uint32_t max_request_sectors() const noexcept
+  { return max_sectors_; }
+  
+  /** Device requests sent, and not yet completed */
+  inline size_t inflight() const noexcept
+  { return inflight_count_; }
+  
+  /** Device requests waiting for room in the ring */
+  inline size_t waiting() const noexcept
+  { return waiting_.size(); }
+  
   /** Constructor. @param pcidev an initialized PCI device. */
   VirtioBlk(hw::PCI_Device& pcidev);
   
@@ -89,43 +121,73 @@ private:
     /// SCSI ///
     //char* cmd = nullptr;
   } __attribute__((packed));
-  struct blk_data_t
-  {
-    uint8_t sector[512];
-    uint32_t stuff1;
-    on_read_func* handler;
-    uint32_t stuff2;
-    uint8_t status;
-  } __attribute__((packed));
   
+  /** One read, write or flush from the user, done in one or more device requests */
+  struct job_t
+  {
+    buffer_t      buf;
+    uint32_t      parts = 0;
+    bool          ok    = true;
+    on_read_func  on_read;
+    on_write_func on_write;
+  };
+  using Job = std::shared_ptr<job_t>;
+  
+  /** A device request: header, data and the status the device writes */
   struct request_t
   {
     scsi_header_t hdr;
-    blk_data_t    data;
-  } __attribute__((packed));
+    uint8_t*      data;
+    uint32_t      len;
+    uint8_t       status;
+    Job           job;
+  };
   
   /** Get virtio PCI config. @see Virtio::get_config.*/
   void get_config();
   
-  /** Service the RX Queue. 
-      Push incoming data up to linklayer, dequeue RX buffers. */
+  /** Service the request queue. Complete used requests, and send
+      waiting ones now that there is room. */
   void service_RX();
   
-  /** Service the TX Queue 
-      Dequeue used TX buffers. @note: This function does not take any 
-      responsibility for memory management. */
-  void service_TX();
-  
   /** Handle device IRQ. 
       
       Will look for config. changes and service RX/TX queues as necessary.*/
   void irq_handler();
   
+  /** Split a job into device requests of at most max_sectors_ and send them */
+  void submit(uint32_t type, block_t blk, block_t count, Job job);
+  
+  /** Send waiting requests, as many as the ring has room for */
+  void send_waiting();
+  
+  /** Put a request in the ring */
+  void enqueue(request_t* r);
+  
+  /** A request is done. Completes its job with the last one */
+  void complete(request_t* r);
+  
+  /** Ring descriptors a request takes */
+  uint16_t descriptors(const request_t& r) const;
+  
   Virtio::Queue req;
   
   // configuration as read from paravirtual PCI device
   virtio_blk_config_t config;
-  uint16_t request_counter;
+  
+  /** Slots for requests in the ring, one per descriptor at most */
+  std::vector<request_t> requests_;
+  std::vector<request_t*> free_;
+  /** The request sent with each ring head */
+  std::vector<request_t*> by_head_;
+  /** Requests not in the ring yet, in order */
+  std::deque<request_t> waiting_;
+  size_t inflight_count_ = 0;
+  
+  /** Limits from SEG_MAX / SIZE_MAX and the indirect table size */
+  uint32_t seg_max_;
+  uint32_t size_max_;
+  uint32_t max_sectors_;
 };
 
 #endif
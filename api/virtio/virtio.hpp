@@ -185,7 +185,41 @@ public:
     uint16_t _num_added = 0; // Entries to be added to _queue.avail->idx
     uint16_t _last_used_idx = 0; // Last entry inserted by device
     uint16_t _pci_index = 0; // Queue nr.
+    bool _event_idx = false; // Using VIRTIO_F_RING_EVENT_IDX
     //void **_data;
+
+    /** VIRTIO_F_RING_INDIRECT_DESC: One table of indirect_max descriptors per
+        ring descriptor. A chain placed in a table uses just its head in the
+        ring, so the table is free again once the head is. */
+    virtq_desc* _indirect = nullptr;
+
+    /** The indirect table belonging to ring descriptor head */
+    inline virtq_desc* indirect_table(uint16_t head)
+    { return _indirect + head * indirect_max; }
+
+    /** Enqueue a chain as one ring descriptor, pointing to its indirect table */
+    int enqueue_indirect(scatterlist sg[], uint32_t out, uint32_t in);
+
+    /** The data of a used ring descriptor, looking through indirect ones */
+    inline void* desc_data(uint16_t id)
+    {
+      auto& desc = _queue.desc[id];
+      if (desc.flags & VIRTQ_DESC_F_INDIRECT)
+        return (void*) indirect_table(id)[0].addr;
+      return (void*) desc.addr;
+    }
+
+    /** VIRTIO_F_RING_EVENT_IDX: Interrupt us when the used idx passes this */
+    inline u16& used_event()
+    { return _queue.avail->ring[_size]; }
+
+    /** VIRTIO_F_RING_EVENT_IDX: Notify the device when the avail idx passes this */
+    inline u16& avail_event()
+    { return *reinterpret_cast<u16*>(&_queue.used->ring[_size]); }
+
+    /** Virtio std. §2.4.7.2: Whether going from old to new_idx passed event */
+    static inline bool need_event(u16 event, u16 new_idx, u16 old)
+    { return (u16)(new_idx - event - 1) < (u16)(new_idx - old); }
     
         
     /** Handler for data coming in on virtq.used. */
@@ -210,17 +244,54 @@ public:
         @param sg : A scatterlist of tokens
         @param out : The number of outbound tokens (device-readable - TX)
         @param in : The number of tokens to be inbound (device-writable RX)
+        @return The head token, which dequeue(len, head) hands back once used
     */
     int enqueue(scatterlist sg[], uint32_t out, uint32_t in, void*);
     
     void enqueue(void* out, uint32_t out_len, void* in, uint32_t in_len);
+
+    /** Longest chain that fits in an indirect table. Longer ones are chained
+        in the ring as usual. */
+    static constexpr uint16_t indirect_max = 32;
+
+    /** Place chains of more than one token in indirect tables, using one
+        ring descriptor each. Only once VIRTIO_F_RING_INDIRECT_DESC is negotiated. */
+    void set_indirect(bool on);
+
+    inline bool indirect() const
+    { return _indirect != nullptr; }
+
+    /** Ring descriptors needed for a chain of n tokens */
+    inline uint16_t descriptors_needed(uint32_t n) const
+    { return (indirect() and n > 1 and n <= indirect_max) ? 1 : n; }
     void* dequeue(uint32_t& len);
+
+    /** Dequeue a used token chain. 
+        @param head : Set to the head token, as returned from enqueue 
+        @return The data of the head token, or nullptr if nothing was used */
+    void* dequeue(uint32_t& len, uint16_t& head);
     
     /** Dequeue a received packet. From SanOS */
     uint8_t* dequeue(uint32_t* len);
     
+    /** Suppress interrupts. With EVENT_IDX this is a hint: the device
+        won't interrupt again until it passes the last used_event. */
     void disable_interrupts();
+
+    /** Interrupt on the next used buffer */
     void enable_interrupts();
+
+    /** Interrupt once @n more buffers are used. Needs EVENT_IDX,
+        otherwise it's the same as enable_interrupts() */
+    void enable_interrupts(uint16_t n);
+
+    /** Use VIRTIO_F_RING_EVENT_IDX for interrupt and kick suppression.
+        Only once the feature is negotiated. */
+    inline void set_event_idx(bool on)
+    { _event_idx = on; }
+
+    inline bool event_idx() const
+    { return _event_idx; }
     
     void set_data_handler(delegate<int(uint8_t* data,int len)> dataHandler);
     
@@ -280,7 +351,7 @@ public:
   uint32_t probe_features();
   
   /** Get locally stored features */
-  inline uint32_t features(){ return _features; };
+  inline uint32_t features() const { return _features; };
   
   /** Get iobase. Wrapper around PCI_Device::iobase */
   inline uint32_t iobase(){ return _iobase; }
@@ -38,6 +38,8 @@
 #include "virtio.hpp"
 #include "../net/ethernet.hpp"
 #include "../net/buffer_store.hpp"
+#include <deque>
+#include <vector>
 #include <delegate>
 
 /** Virtio Net Features. From Virtio Std. 5.1.3 */
@@ -108,6 +110,14 @@
 #define VIRTIO_NET_S_LINK_UP  1
 #define VIRTIO_NET_S_ANNOUNCE 2
 
+// virtio_net_hdr flags. From Virtio 1.01, 5.1.6
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+#define VIRTIO_NET_HDR_F_DATA_VALID 2
+
+// virtio_net_hdr gso_type. From Virtio 1.01, 5.1.6
+#define VIRTIO_NET_HDR_GSO_NONE  0
+#define VIRTIO_NET_HDR_GSO_TCPV4 1
+
 /** Virtio-net device driver.  */
 class VirtioNet : Virtio {
   
@@ -122,8 +132,8 @@ class VirtioNet : Virtio {
   }__attribute__((packed));
 
   /** Virtio std. § 5.1.6.1: 
-      "The legacy driver only presented num_buffers in the struct virtio_net_hdr when VIRTIO_NET_F_MRG_RXBUF was not negotiated; without that feature the structure was 2 bytes shorter." */
-  struct virtio_net_hdr_nomerge
+      "The legacy driver only presented num_buffers in the struct virtio_net_hdr when VIRTIO_NET_F_MRG_RXBUF was negotiated; without that feature the structure was 2 bytes shorter." */
+  struct virtio_net_hdr_mrg_rxbuf
   {
     uint8_t flags;
     uint8_t gso_type;
@@ -139,6 +149,10 @@ class VirtioNet : Virtio {
       It's ok to use as long as we don't need checksum offloading
       or other 'fancier' virtio features. */
   constexpr static virtio_net_hdr empty_header = {0,0,0,0,0,0}; 
+
+  /** The same, for when MRG_RXBUF is negotiated. On a legacy device the
+      header is then 2 bytes longer, in both directions. */
+  constexpr static virtio_net_hdr_mrg_rxbuf empty_header_mrg = {0,0,0,0,0,0,0};
   
   Virtio::Queue rx_q;
   Virtio::Queue tx_q;
@@ -165,30 +179,118 @@ class VirtioNet : Virtio {
   
   
   /** Service the RX Queue. 
-      Push incoming data up to linklayer, dequeue RX buffers. */
+      Push up to rx_budget() frames up to linklayer with interrupts off,
+      then refill the ring and kick once. If there's more to do, carry on
+      from the event loop, otherwise re-arm interrupts. */
   void service_RX();
   
   /** Service the TX Queue 
-      Dequeue used TX buffers. @note: This function does not take any 
-      responsibility for memory management. */
+      Drop our reference to every frame the device is done with, then move
+      backlogged frames into the freed up slots. */
   void service_TX();
 
+  /** Put a frame in the TX ring, holding on to it until it's used. 
+      @note: There must be room, @see tx_room */
+  void enqueue_tx(net::Packet_ptr pckt);
+
+  /** Whether the TX ring has the descriptors for pckt, header included */
+  bool tx_room(const net::Packet& pckt);
+
+  /** Frames in the TX ring, by head descriptor. The device reads straight
+      from their buffers, so they can't be released before it's done. */
+  std::vector<net::Packet_ptr> tx_inflight_;
+
+  /** Frames that didn't fit in the TX ring. Sent from service_TX. */
+  std::deque<net::Packet_ptr> tx_backlog_;
+
+  /** Told when there's room in the TX ring again */
+  net::transmit_avail_delg transmit_queue_available_event_;
+
+  /** Times transmit found the TX ring full */
+  uint64_t tx_ring_full_ {0};
+
   /** Handle device IRQ. 
       
       Will look for config. changes and service RX/TX queues as necessary.*/
   void irq_handler();
   
-  /** Allocate and queue buffer from bufstore_ in RX queue. */
+  /** Get the header to send in front of pckt, with any offloads filled in.
+      It's tx_header_size() long. */
+  const virtio_net_hdr* tx_header(net::Packet& pckt);
+
+  /** The size of the header in front of every frame sent */
+  inline size_t tx_header_size() const
+  { return mergeable_rx() ? sizeof(virtio_net_hdr_mrg_rxbuf) : sizeof(virtio_net_hdr); }
+
+  /** Allocate and queue buffer from bufstore_ in RX queue.
+      @return -1 if the store is at its ceiling, and nothing was queued */
   int add_receive_buffer();  
 
+  /** RX buffers missing from the ring, for lack of buffers. service_RX
+      posts them when it can, and won't pass on frames it can't replace. */
+  int rx_deficit_ {0};
+
+  /** Whether RX buffers are mergeable, i.e. one frame may span several */
+  inline bool mergeable_rx() const
+  { return features() & (1 << VIRTIO_NET_F_MRG_RXBUF); }
+
+  /** Where the header goes in an RX buffer. Without MRG_RXBUF, the
+      shorter header sits right in front of the frame. */
+  inline size_t rx_header_offset() const
+  { return mergeable_rx() ? 0 : rx_headroom - sizeof(virtio_net_hdr); }
+
+  /** The header of a received frame, at the start of its first buffer */
+  inline virtio_net_hdr* rx_header(uint8_t* buf) const
+  { return reinterpret_cast<virtio_net_hdr*>(buf + rx_header_offset()); }
+
+  /** The RX buffer, from what dequeue gives back (the data of its head
+      descriptor, which is the header) */
+  inline uint8_t* rx_buffer(void* head_data) const
+  { return static_cast<uint8_t*>(head_data) - rx_header_offset(); }
+
+  /** Turn a received frame (possibly spanning several buffers) into a Packet.
+      @param buf:  The start of its first buffer, @see rx_buffer
+      @param used: Incremented with the number of buffers passed upwards */
+  net::Packet_ptr receive_frame(uint8_t* buf, uint32_t len, int& used);
+
+  /** Leave RX interrupts off, and carry on servicing RX from the event loop */
+  void defer_RX();
+
+  /** Max. frames to pass on per round of service_RX */
+  int rx_budget_ {64};
+  bool rx_deferred_ {false};
+
+  /** RX statistics */
+  uint64_t rx_interrupts_ {0};
+  uint64_t rx_packets_ {0};
+
+  /** Queue an already used RX buffer in the RX queue again. */
+  void recycle_receive_buffer(uint8_t* buf);
+
+  /** Called by bufstore_ when it's about to run out of buffers. */
+  void on_low_buffers(net::BufferStore&);
+
   /** Upstream delegate for linklayer output */
   net::upstream _link_out;
 
+  /** Room for the largest (mergeable) header in front of every frame.
+      Without MRG_RXBUF the shorter header sits right in front of the frame. */
+  static constexpr size_t rx_headroom = sizeof(virtio_net_hdr_mrg_rxbuf);
+
+  /** Room for a full-sized frame, Ethernet header included */
+  static constexpr size_t max_frame =
+    net::Ethernet::MAXIMUM_PAYLOAD + sizeof(net::Ethernet::header);
+
   /** 20-bit / 1MB of buffers to start with */
-  net::BufferStore bufstore_{ 0xfffffU / MTU(),  MTU(), sizeof(virtio_net_hdr) };
+  net::BufferStore bufstore_{ 0xfffffU / MTU(),  max_frame + rx_headroom, rx_headroom };
   net::BufferStore::release_del release_buffer = 
     net::BufferStore::release_del::from
     <net::BufferStore, &net::BufferStore::release_offset_buffer>(bufstore_);
+
+  /** For the 2nd, 3rd.. buffer of a merged frame, which is all data */
+  net::BufferStore::release_del release_raw_buffer =
+    net::BufferStore::release_del::from
+    <net::BufferStore, &net::BufferStore::release_raw_buffer>(bufstore_);
   
 public:     
   
@@ -211,9 +313,45 @@ public:
   { return _link_out; }
   
   inline net::BufferStore& bufstore() { return bufstore_; }
+
+  /** Whether the host fills in partial checksums for us (VIRTIO_NET_F_CSUM) */
+  inline bool checksum_offload() const
+  { return features() & (1 << VIRTIO_NET_F_CSUM); }
+
+  /** Whether the host segments large TCP packets for us (VIRTIO_NET_F_HOST_TSO4) */
+  inline bool tso() const
+  { return checksum_offload() and (features() & (1 << VIRTIO_NET_F_HOST_TSO4)); }
   
-  /** Linklayer input. Hooks into IP-stack bottom, w.DOWNSTREAM data.*/
+  /** Max. frames passed upwards per round of RX servicing (NAPI-style budget) */
+  inline int rx_budget() const { return rx_budget_; }
+  inline void set_rx_budget(int budget) { rx_budget_ = budget > 0 ? budget : 1; }
+
+  /** Number of RX interrupts, and frames received */
+  inline uint64_t rx_interrupts() const { return rx_interrupts_; }
+  inline uint64_t rx_packets() const { return rx_packets_; }
+
+  /** Frames received per RX interrupt. Grows with the load, if batching works. */
+  inline double rx_packets_per_interrupt() const
+  { return rx_interrupts_ ? double(rx_packets_) / rx_interrupts_ : 0; }
+
+  /** Linklayer input. Hooks into IP-stack bottom, w.DOWNSTREAM data.
+      If the TX ring is full, the frame waits in a backlog until there's room. */
   void transmit(net::Packet_ptr pckt);
+
+  /** Number of (unchained) frames the TX ring can take right now.
+      0 means it's full, and further frames will be backlogged. */
+  inline size_t transmit_queue_available()
+  { return tx_backlog_.empty() ? tx_q.num_free() / tx_q.descriptors_needed(2) : 0; }
+
+  /** Get called once the TX ring has room again, after it was full. */
+  inline void on_transmit_queue_available(net::transmit_avail_delg del)
+  { transmit_queue_available_event_ = del; }
+
+  /** Frames waiting for room in the TX ring */
+  inline size_t tx_backlog() const { return tx_backlog_.size(); }
+
+  /** Times transmit found the TX ring full */
+  inline uint64_t tx_ring_full() const { return tx_ring_full_; }
   
   /** Constructor. @param pcidev an initialized PCI device. */
   VirtioNet(hw::PCI_Device& pcidev);
@@ -160,8 +160,28 @@ namespace fs
       INFO2("[ofs=%u  size=%u (%u bytes)]\n", 
           this->lba_base, this->lba_size, this->lba_size * 512);
       
-      // on_mount callback
-      on_mount(no_error);
+      // nothing listed on what was mounted before is valid anymore
+      invalidate();
+      this->table = nullptr;
+      
+      // keep the allocation table in memory, so following cluster
+      // chains doesn't need any I/O
+      uint64_t table_size = (uint64_t) this->sectors_per_fat * sector_size;
+      if (table_size > TABLE_MAX)
+      {
+        debug("FAT is %llu bytes, reading it as needed\n", table_size);
+        on_mount(no_error);
+        return;
+      }
+      device.read(this->lba_base + this->reserved, this->sectors_per_fat,
+      [this, on_mount] (buffer_t data)
+      {
+        // without it, chains are followed from the disk
+        if (!data) debug("Could not read the FAT, reading it as needed\n");
+        this->table = data;
+        // on_mount callback
+        on_mount(no_error);
+      });
     });
   }
   
@@ -315,78 +335,85 @@ namespace fs
     (*next)(sector);
   }
   
+  void FAT::index_dir(const std::string& key, dirvec_t ents)
+  {
+    dirs.emplace(key, ents);
+    for (auto& e : *ents)
+      index.emplace(key + e.name(), e);
+  }
+  
+  void FAT::invalidate()
+  {
+    dirs.clear();
+    index.clear();
+  }
+  
   void FAT::traverse(std::shared_ptr<Path> path, cluster_func callback)
   {
     // parse this path into a stack of memes
-    typedef std::function<void(uint32_t)> next_func_t;
+    typedef std::function<void(uint32_t, const std::string&)> next_func_t;
     
     // asynch stack traversal
     auto next = std::make_shared<next_func_t> ();
     *next = 
-    [this, path, next, callback] (uint32_t cluster)
+    [this, path, next, callback] (uint32_t cluster, const std::string& key)
     {
-      if (path->empty())
+      // with the directory listed, go on to the next name
+      auto on_dir = 
+      [this, path, next, callback, key] (error_t error, dirvec_t ents)
       {
-        // attempt to read directory
-        uint32_t S = this->cl_to_sector(cluster);
-        
-        // result allocated on heap
-        auto dirents = std::make_shared<std::vector<Dirent>> ();
-        
-        int_ls(S, dirents,
-        [callback] (error_t error, dirvec_t ents)
+        if (unlikely(error) || path->empty())
         {
           callback(error, ents);
-        });
+          return;
+        }
+        // retrieve next name
+        std::string name = path->front();
+        path->pop_front();
+        
+        // look for name in directory
+        auto* ent = index.find(key + name);
+        if (unlikely(ent == nullptr))
+        {
+          debug("NO MATCH for %s\n", name.c_str());
+          callback(true, ents);
+          return;
+        }
+        // only follow directories
+        if (ent->type() != DIR)
+        {
+          callback(true, ents);
+          return;
+        }
+        // enter the matching directory
+        debug("Found match for %s, cluster: %llu\n", name.c_str(), ent->block);
+        (*next)(ent->block, key + name + "/");
+      };
+      
+      // listed before, no need to go to the disk
+      auto* cached = dirs.find(key);
+      if (cached)
+      {
+        on_dir(no_error, *cached);
         return;
       }
       
-      // retrieve next name
-      std::string name = path->front();
-      path->pop_front();
-      
       uint32_t S = this->cl_to_sector(cluster);
-      debug("Current target: %s on cluster %u (sector %u)\n", name.c_str(), cluster, S);
+      debug("Listing %s on cluster %u (sector %u)\n", key.c_str(), cluster, S);
       
       // result allocated on heap
       auto dirents = std::make_shared<std::vector<Dirent>> ();
       
       // list directory contents
       int_ls(S, dirents,
-      [name, dirents, next, callback] (error_t error, dirvec_t ents)
+      [this, key, on_dir] (error_t error, dirvec_t ents)
       {
-        if (unlikely(error))
-        {
-          debug("Could not find: %s\n", name.c_str());
-          callback(true, dirents);
-          return;
-        }
-        
-        // look for name in directory
-        for (auto& e : *ents)
-        {
-          if (unlikely(e.name() == name))
-          {
-            // go to this directory, unless its the last name
-            debug("Found match for %s", name.c_str());
-            // enter the matching directory
-            debug("\t\t cluster: %llu\n", e.block);
-            // only follow directories
-            if (e.type() == DIR)
-              (*next)(e.block);
-            else
-              callback(true, dirents);
-            return;
-          }
-        } // for (ents)
-        
-        debug("NO MATCH for %s\n", name.c_str());
-        callback(true, dirents);
+        if (!error) index_dir(key, ents);
+        on_dir(error, ents);
       });
-      
     };
     // start by reading root directory
-    (*next)(0);
+    (*next)(0, "/");
   }
   
   void FAT::ls(const std::string& path, on_ls_func on_ls)
@@ -397,7 +424,8 @@ namespace fs
     traverse(pstk, 
     [on_ls] (error_t error, dirvec_t dirents)
     {
-      on_ls(error, dirents);
+      // the listing is shared with the index, hand out a copy
+      on_ls(error, std::make_shared<dirvector> (*dirents));
     });
   }
   
@@ -407,57 +435,252 @@ namespace fs
     callback(buf.err, buf.buffer, buf.len);
   }
   
-  void FAT::readFile(const Dirent& ent, on_read_func callback)
+  uint32_t FAT::cl_next(uint32_t cl, const uint8_t* entry) const
+  {
+    if (fat_type == T_FAT12)
+    {
+      // 12-bit entries are packed, two in three bytes
+      uint16_t value = entry[0] | (entry[1] << 8);
+      return (cl & 1) ? value >> 4 : value & 0xFFF;
+    }
+    else if (fat_type == T_FAT16)
+      return entry[0] | (entry[1] << 8);
+    else // T_FAT32, the top 4 bits are reserved
+      return *(uint32_t*) entry & 0x0FFFFFFF;
+  }
+  
+  bool FAT::cl_is_last(uint32_t cl) const
   {
-    // cluster -> sector
-    uint32_t sector = this->cl_to_sector(ent.block);
-    // number of sectors to read ahead
-    size_t chunks = ent.size / sector_size + 1;
-    // allocate buffer
-    auto* buffer = new uint8_t[chunks * sector_size];
-    // at which sector we will stop
-    size_t total   = chunks;
-    size_t current = 0;
+    if (fat_type == T_FAT12)
+      return cl >= 0xFF8;
+    else if (fat_type == T_FAT16)
+      return cl >= 0xFFF8;
+    else // T_FAT32
+      return cl >= 0x0FFFFFF8;
+  }
+  
+  void FAT::add_cluster(extents_t& exts, uint32_t cl, uint32_t& sectors_left)
+  {
+    uint32_t sector = cl_to_sector(cl);
+    // only the sectors the file actually uses
+    uint32_t count = sectors_per_cluster;
+    if (count > sectors_left) count = sectors_left;
+    sectors_left -= count;
     
-    typedef std::function<void(uint32_t, size_t, size_t)> next_func_t;
-    auto next = std::make_shared<next_func_t> ();
+    while (count)
+    {
+      if (!exts.empty()
+        && exts.back().sector + exts.back().count == sector
+        && exts.back().count < EXTENT_MAX)
+      {
+        // consecutive with the last run, extend it
+        uint32_t room = EXTENT_MAX - exts.back().count;
+        uint32_t add  = (count < room) ? count : room;
+        exts.back().count += add;
+        sector += add;
+        count  -= add;
+      }
+      else
+      {
+        uint32_t add = (count < EXTENT_MAX) ? count : EXTENT_MAX;
+        exts.push_back({sector, add});
+        sector += add;
+        count  -= add;
+      }
+    }
+  }
+  
+  struct FAT::chain_walk
+  {
+    std::shared_ptr<extents_t> exts;
+    uint32_t        sectors_left;
+    on_extents_func callback;
+  };
+  
+  void FAT::extents(const Dirent& ent, on_extents_func callback)
+  {
+    auto walk = std::make_shared<chain_walk> ();
+    walk->exts = std::make_shared<extents_t> ();
+    walk->sectors_left = (ent.size + sector_size - 1) / sector_size;
+    walk->callback = callback;
     
-    *next = 
-    [this, buffer, ent, callback, next] (uint32_t sector, size_t current, size_t total)
+    // empty files have no clusters at all
+    if (walk->sectors_left == 0)
+    {
+      callback(no_error, walk->exts);
+      return;
+    }
+    if (unlikely(!cl_is_valid(ent.block)))
+    {
+      debug("extents: invalid first cluster %llu\n", ent.block);
+      callback(true, walk->exts);
+      return;
+    }
+    add_cluster(*walk->exts, ent.block, walk->sectors_left);
+    
+    if (this->table)
     {
-      if (unlikely(current == total))
+      // the whole FAT is in memory
+      uint32_t cl = ent.block;
+      auto err = follow_chain(*walk, cl, table.get(), 0, sectors_per_fat * sector_size);
+      if (!err && walk->sectors_left)
       {
-        // report back to HQ
-        debug("DONE SIZE: %lu  (current=%lu, total=%lu)\n", 
-            ent.size, current, total);
-        // create shared buffer
-        auto buffer_ptr = buffer_t(buffer, std::default_delete<uint8_t[]>());
-        // notify caller
-        callback(no_error, buffer_ptr, ent.size);
+        debug("extents: chain runs past the end of the FAT at %u\n", cl);
+        err = true;
+      }
+      callback(err, walk->exts);
+      return;
+    }
+    walk_chain(walk, ent.block);
+  }
+  
+  error_t FAT::follow_chain(chain_walk& walk, uint32_t& cl,
+      const uint8_t* fat, uint32_t start, uint32_t end)
+  {
+    while (walk.sectors_left)
+    {
+      // stop when the entry is outside of what we have
+      // (FAT12 entries can straddle it, so there must be 2 bytes)
+      uint32_t byte = cl_to_entry_byte(cl);
+      if (byte < start || byte + 2 > end)
+        return no_error;
+      
+      uint32_t next = cl_next(cl, fat + (byte - start));
+      if (unlikely(cl_is_last(next) || !cl_is_valid(next)))
+      {
+        // the chain ends before the file does
+        debug("follow_chain: broken chain at cluster %u (next %u)\n", cl, next);
+        return true;
+      }
+      add_cluster(*walk.exts, next, walk.sectors_left);
+      cl = next;
+    }
+    return no_error;
+  }
+  
+  void FAT::walk_chain(std::shared_ptr<chain_walk> walk, uint32_t cl)
+  {
+    if (walk->sectors_left == 0)
+    {
+      walk->callback(no_error, walk->exts);
+      return;
+    }
+    // read a window of the FAT starting at the entry for @cl,
+    // and follow the chain for as long as it stays within it
+    uint32_t first = cl_to_entry_sector(cl);
+    
+    device.read(lba_base + first, FAT_WINDOW,
+    [this, walk, cl, first] (buffer_t data)
+    {
+      if (!data)
+      {
+        debug("walk_chain: failed to read FAT sector %u\n", first);
+        walk->callback(true, walk->exts);
         return;
       }
-      device.read(sector,
-      [this, current, total, buffer, ent, &callback, sector, next] (buffer_t data)
+      // the window, in bytes from the start of the FAT
+      const uint32_t start = (first - reserved) * sector_size;
+      const uint32_t end   = start + FAT_WINDOW * sector_size;
+      uint32_t current = cl;
+      
+      if (follow_chain(*walk, current, data.get(), start, end))
       {
-        if (!data)
-        {
-          // general I/O error occurred
-          debug("Failed to read sector %u for read()", sector);
-          // cleanup
-          delete[] buffer;
-          callback(true, buffer_t(), 0);
-          return;
-        }
-        
-        // copy over data
-        memcpy(buffer + current * sector_size, data.get(), sector_size);
-        // continue reading next sector
-        (*next)(sector+1, current+1, total);
-      });
-    };
+        walk->callback(true, walk->exts);
+        return;
+      }
+      // the chain goes on outside of this window, read the next one
+      if (walk->sectors_left)
+      {
+        walk_chain(walk, current);
+        return;
+      }
+      walk->callback(no_error, walk->exts);
+    });
+  }
+  
+  struct FAT::extent_read
+  {
+    std::shared_ptr<extents_t> exts;
+    buffer_t     buffer;
+    uint64_t     offset;
+    uint64_t     size;
+    on_read_func callback;
+  };
+  
+  void FAT::read_extents(std::shared_ptr<extent_read> job, size_t idx)
+  {
+    if (idx == job->exts->size())
+    {
+      // report back to HQ
+      debug("DONE SIZE: %llu  (%u extents)\n", job->size, job->exts->size());
+      job->callback(no_error, job->buffer, job->size);
+      return;
+    }
+    const Extent ext = (*job->exts)[idx];
     
-    // start!
-    (*next)(sector, current, total);
+    device.read(ext.sector, ext.count,
+    [this, job, idx, ext] (buffer_t data)
+    {
+      if (!data)
+      {
+        // general I/O error occurred
+        debug("Failed to read %u sectors from %u for readFile()\n",
+              ext.count, ext.sector);
+        job->callback(true, buffer_t(), 0);
+        return;
+      }
+      // copy over data
+      memcpy(job->buffer.get() + job->offset, data.get(), ext.count * sector_size);
+      job->offset += ext.count * sector_size;
+      // continue with the next run of sectors
+      read_extents(job, idx + 1);
+    });
+  }
+  
+  void FAT::readFile(const Dirent& ent, on_read_func callback)
+  {
+    uint64_t size = ent.size;
+    // find where the file is first, then read it in as few reads as possible
+    extents(ent,
+    [this, size, callback] (error_t error, std::shared_ptr<extents_t> exts)
+    {
+      if (unlikely(error))
+      {
+        callback(true, buffer_t(), 0);
+        return;
+      }
+      uint64_t sectors = 0;
+      bool contiguous = true;
+      for (auto& ext : *exts)
+      {
+        contiguous = contiguous && (ext.sector == exts->front().sector + sectors);
+        sectors += ext.count;
+      }
+      
+      // the whole file in one piece: hand over what the device gives us,
+      // rather than copying it (on MemDisk, that's the image itself)
+      if (contiguous && !exts->empty())
+      {
+        device.read(exts->front().sector, sectors,
+        [size, callback] (buffer_t data)
+        {
+          if (!data)
+            callback(true, buffer_t(), 0);
+          else
+            callback(no_error, data, size);
+        });
+        return;
+      }
+      
+      auto job = std::make_shared<extent_read> ();
+      job->exts   = exts;
+      job->buffer = buffer_t(new uint8_t[sectors * sector_size],
+                             std::default_delete<uint8_t[]>());
+      job->offset = 0;
+      job->size   = size;
+      job->callback = callback;
+      read_extents(job, 0);
+    });
   }
   
   void FAT::readFile(const std::string& strpath, on_read_func callback)
@@ -474,8 +697,16 @@ namespace fs
     std::string filename = path->back();
     path->pop_back();
     
+    // the file is in a directory listed before
+    auto* ent = index.find(path->to_string() + filename);
+    if (ent)
+    {
+      readFile(*ent, callback);
+      return;
+    }
+    
     traverse(path,
-    [this, filename, &callback] (error_t error, dirvec_t dirents)
+    [this, filename, callback] (error_t error, dirvec_t dirents)
     {
       if (unlikely(error))
       {
@@ -494,6 +725,9 @@ namespace fs
           return;
         }
       }
+      
+      // not found
+      callback(true, nullptr, 0);
     });
   } // readFile()
   
@@ -512,6 +746,14 @@ namespace fs
     // extract file we are looking for
     std::string filename = path->back();
     path->pop_back();
+    
+    // the entry is in a directory listed before
+    auto* ent = index.find(path->to_string() + filename);
+    if (ent)
+    {
+      func(no_error, *ent);
+      return;
+    }
     // we need to remember this later
     auto callback = std::make_shared<on_stat_func> (func);
     
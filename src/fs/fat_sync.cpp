@@ -95,59 +95,66 @@ namespace fs
     return no_error;
   }
   
+  error_t FAT::index_ls(const std::string& key, uint32_t cluster, dirvec_t& ents)
+  {
+    // listed before, no need to go to the disk
+    auto* cached = dirs.find(key);
+    if (cached)
+    {
+      ents = *cached;
+      return no_error;
+    }
+    auto dirents = new_shared_vector();
+    // sync read entire directory
+    auto err = int_ls(this->cl_to_sector(cluster), dirents);
+    if (err) return err;
+    
+    index_dir(key, dirents);
+    ents = dirents;
+    return no_error;
+  }
+  
   error_t FAT::traverse(Path path, dirvec_t ents)
   {
     // start with root dir
     uint32_t cluster = 0;
+    std::string key = "/";
     // directory entries are read into this
-    auto dirents = new_shared_vector();
-    Dirent found(INVALID_ENTITY);
+    dirvec_t dirents;
     
     while (!path.empty())
     {
-      uint32_t S = this->cl_to_sector(cluster);
-      dirents->clear(); // mui importante
-      // sync read entire directory
-      auto err = int_ls(S, dirents);
+      auto err = index_ls(key, cluster, dirents);
       if (err) return err;
       // the name we are looking for
       std::string name = path.front();
       path.pop_front();
       
-      // check for matches in dirents
-      for (auto& e : *dirents)
-      if (unlikely(e.name() == name))
-      {
-        // go to this directory, unless its the last name
-        debug("traverse_sync: Found match for %s", name.c_str());
-        // enter the matching directory
-        debug("\t\t cluster: %lu\n", e.block);
-        // only follow if the name is a directory
-        if (e.type() == DIR)
-        {
-          found = e;
-          break;
-        }
-        else
-        {
-          // not dir = error, for now
-          return true;
-        }
-      } // for (ents)
-      
-      // validate result
-      if (found.type() == INVALID_ENTITY)
+      // check for a match in the directory
+      auto* found = index.find(key + name);
+      if (found == nullptr)
       {
         debug("traverse_sync: NO MATCH for %s\n", name.c_str());
         return true;
       }
+      // only follow if the name is a directory
+      if (found->type() != DIR)
+      {
+        // not dir = error, for now
+        return true;
+      }
+      debug("traverse_sync: Found match for %s, cluster: %llu\n", name.c_str(), found->block);
       // set next cluster
-      cluster = found.block;
+      cluster = found->block;
+      key += name + "/";
     }
     
-    uint32_t S = this->cl_to_sector(cluster);
     // read result directory entries into ents
-    return int_ls(S, ents);
+    auto err = index_ls(key, cluster, dirents);
+    if (err) return err;
+    // the listing is shared with the index, hand out a copy
+    ents->insert(ents->end(), dirents->begin(), dirents->end());
+    return no_error;
   }
   
   error_t FAT::ls(const std::string& strpath, dirvec_t ents)
@@ -168,22 +175,21 @@ namespace fs
     // extract file we are looking for
     std::string filename = path.back();
     path.pop_back();
+    std::string key = path.to_string() + filename;
+    
+    // the entry is in a directory listed before
+    auto* ent = index.find(key);
+    if (ent) return *ent;
     
     // result directory entries are put into @dirents
     auto dirents = std::make_shared<std::vector<Dirent>> ();
     
+    // listing the directory puts its entries in the index
     auto err = traverse(path, dirents);
     if (err) return Dirent(INVALID_ENTITY); // for now
     
-    // find the matching filename in directory
-    for (auto& e : *dirents)
-    {
-      if (unlikely(e.name() == filename))
-      {
-        // return this directory entry
-        return e;
-      }
-    }
+    ent = index.find(key);
+    if (ent) return *ent;
     // entry not found
     return Dirent(INVALID_ENTITY);
   }
@@ -15,10 +15,6 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include <cstring>
-#include <cassert>
-#include <cstdio>
-
 #include <fs/memdisk.hpp>
 
 #define likely(x)       __builtin_expect(!!(x), 1)
@@ -31,51 +27,40 @@ extern "C" {
 
 namespace fs {
 
+/**
+ *  The image is linked in and there for as long as we are, so buffers
+ *  handed out are views into it. They all share this one owner, which
+ *  never deletes anything, so a view doesn't allocate.
+ */
+static const MemDisk::buffer_t& image_owner() {
+  static const MemDisk::buffer_t owner((uint8_t*) &_DISK_START_, [] (uint8_t*) {});
+  return owner;
+}
+
 MemDisk::MemDisk() noexcept
   : image_start { &_DISK_START_ },
     image_end   { &_DISK_END_ }
 {}
 
-void MemDisk::read(block_t blk, on_read_func callback) {
-  auto* sector_loc = ((char*) image_start) + blk * block_size();
+MemDisk::buffer_t MemDisk::view(block_t blk, block_t count) const {
   // Disallow reading memory past disk image
-  if (unlikely(sector_loc >= image_end))
-  {
-    callback(buffer_t()); return;
-  }
-  
-  auto* buffer = new uint8_t[block_size()];
-  assert( memcpy(buffer, sector_loc, block_size()) == buffer );
+  if (unlikely(count == 0 or blk + count > size()))
+    return buffer_t();
   
-  callback( buffer_t(buffer, std::default_delete<uint8_t[]>()) );
+  auto* loc = ((uint8_t*) image_start) + blk * block_size();
+  return buffer_t(image_owner(), loc);
+}
+
+void MemDisk::read(block_t blk, on_read_func callback) {
+  callback( view(blk, 1) );
 }
 
 void MemDisk::read(block_t start, block_t count, on_read_func callback) {
-  auto* start_loc = ((char*) image_start) + start * block_size();
-  auto* end_loc   = start_loc + count * block_size();
-  // Disallow reading memory past disk image
-  if (unlikely(end_loc >= image_end))
-  {
-    callback(buffer_t()); return;
-  }
-  
-  auto* buffer = new uint8_t[count * block_size()];
-  assert( memcpy(buffer, start_loc, count * block_size()) == buffer );
-  
-  callback( buffer_t(buffer, std::default_delete<uint8_t[]>()) );
+  callback( view(start, count) );
 }
 
-MemDisk::buffer_t MemDisk::read_sync(block_t blk)
-{
-  auto* loc = ((char*) image_start) + blk * block_size();
-  // Disallow reading memory past disk image
-  if (unlikely(loc >= image_end))
-    return buffer_t();
-  
-  auto* buffer = new uint8_t[block_size()];
-  assert( memcpy(buffer, loc, block_size()) == buffer );
-  
-  return buffer_t(buffer, std::default_delete<uint8_t[]>());
+MemDisk::buffer_t MemDisk::read_sync(block_t blk) {
+  return view(blk, 1);
 }
 
 MemDisk::block_t MemDisk::size() const noexcept {
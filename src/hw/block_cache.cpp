@@ -0,0 +1,264 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//#define DEBUG
+#include <hw/block_cache.hpp>
+#include <common>
+#include <cstring>
+
+namespace hw {
+
+BlockCache::BlockCache(IDiskDevice& device, size_t budget, block_t readahead)
+  : device_(device),
+    capacity_(budget / device.block_size()),
+    readahead_(readahead ? readahead : 1)
+{
+  debug("<BlockCache> %u blocks of %llu bytes for %s\n",
+        capacity_, device.block_size(), device.name());
+}
+
+void BlockCache::read(block_t blk, on_read_func func)
+{
+  if (blk >= size()) {
+    func(buffer_t());
+    return;
+  }
+  const bool sequential = (blk == next_);
+  next_ = blk + 1;
+
+  if (auto* data = lookup(blk)) {
+    hits_++;
+    func(*data);
+    return;
+  }
+  misses_++;
+
+  // On its way already
+  if (auto* waiting = pending_.find(blk)) {
+    coalesced_++;
+    waiting->push_back(std::move(func));
+    return;
+  }
+
+  // Read ahead, up to what's cached or on its way already
+  block_t count = 1;
+  if (sequential) {
+    while (count < readahead_ and blk + count < size()
+           and not index_.find(blk + count) and not pending_.find(blk + count))
+      count++;
+  }
+  read_ahead_ += count - 1;
+  fetch(blk, count, std::move(func));
+}
+
+void BlockCache::read(block_t blk, block_t count, on_read_func func)
+{
+  if (count == 1) {
+    read(blk, std::move(func));
+    return;
+  }
+  if (count == 0 or blk + count > size()) {
+    func(buffer_t());
+    return;
+  }
+  next_ = blk + count;
+  const auto bs = block_size();
+
+  block_t cached = 0;
+  for (block_t i = 0; i < count; i++)
+    if (index_.find(blk + i))
+      cached++;
+
+  // All of them cached: gather them up
+  if (cached == count) {
+    auto buf = buffer_t(new uint8_t[count * bs], std::default_delete<uint8_t[]>());
+    for (block_t i = 0; i < count; i++)
+      memcpy(buf.get() + i * bs, lookup(blk + i)->get(), bs);
+    hits_ += count;
+    func(buf);
+    return;
+  }
+
+  // Streaming through a large read would push out everything else,
+  // for blocks unlikely to be read again soon. Leave the cache alone.
+  if (count > readahead_) {
+    streamed_ += count;
+    device_.read(blk, count, std::move(func));
+    return;
+  }
+
+  // Otherwise one read for all of them. Only the blocks that weren't
+  // cached are misses
+  hits_   += cached;
+  misses_ += count - cached;
+  auto gen = generation_;
+  device_.read(blk, count,
+    [this, blk, count, bs, gen, func] (buffer_t buf) {
+      if (buf and gen == generation_) {
+        for (block_t i = 0; i < count; i++)
+          insert(blk + i, copy_block(buf.get() + i * bs), false);
+      }
+      func(buf);
+    });
+}
+
+BlockCache::buffer_t BlockCache::read_sync(block_t blk)
+{
+  if (blk >= size())
+    return buffer_t();
+  next_ = blk + 1;
+
+  if (auto* data = lookup(blk)) {
+    hits_++;
+    return *data;
+  }
+  misses_++;
+
+  auto gen = generation_;
+  auto data = device_.read_sync(blk);
+  if (data and gen == generation_)
+    insert(blk, data, true);
+  return data;
+}
+
+void BlockCache::write(block_t blk, block_t count, buffer_t buf, on_write_func func)
+{
+  // Reads that overlap the write may complete on either side of it
+  generation_++;
+  invalidate(blk, count);
+  device_.write(blk, count, std::move(buf),
+    [this, blk, count, func] (bool ok) {
+      generation_++;
+      invalidate(blk, count);
+      func(ok);
+    });
+}
+
+void BlockCache::clear()
+{
+  generation_++;
+  slots_.clear();
+  index_.clear();
+  hand_ = 0;
+}
+
+BlockCache::buffer_t* BlockCache::lookup(block_t blk)
+{
+  auto* slot = index_.find(blk);
+  if (not slot)
+    return nullptr;
+  slots_[*slot].referenced = true;
+  return &slots_[*slot].data;
+}
+
+void BlockCache::insert(block_t blk, buffer_t data, bool referenced)
+{
+  if (auto* slot = index_.find(blk)) {
+    slots_[*slot].data = std::move(data);
+    slots_[*slot].referenced |= referenced;
+    return;
+  }
+  if (capacity_ == 0)
+    return;
+
+  size_t victim;
+  if (slots_.size() < capacity_) {
+    victim = slots_.size();
+    slots_.emplace_back();
+  }
+  else {
+    // A second chance for every block used since the hand last passed it
+    while (slots_[hand_].referenced) {
+      slots_[hand_].referenced = false;
+      hand_ = (hand_ + 1) % slots_.size();
+    }
+    victim = hand_;
+    hand_ = (hand_ + 1) % slots_.size();
+
+    if (slots_[victim].data) {
+      index_.erase(slots_[victim].blk);
+      evictions_++;
+    }
+  }
+
+  auto& slot = slots_[victim];
+  slot.blk  = blk;
+  slot.data = std::move(data);
+  slot.referenced = referenced;
+  index_.emplace(blk, victim);
+}
+
+void BlockCache::invalidate(block_t blk, block_t count)
+{
+  for (block_t b = blk; b < blk + count; b++) {
+    if (auto* slot = index_.find(b)) {
+      // An empty slot is the first CLOCK picks
+      slots_[*slot] = Slot{};
+      index_.erase(b);
+    }
+  }
+}
+
+void BlockCache::fetch(block_t blk, block_t count, on_read_func func)
+{
+  // The device may call back before read() returns
+  pending_.emplace(blk, std::vector<on_read_func>{std::move(func)});
+  for (block_t i = 1; i < count; i++)
+    pending_.emplace(blk + i, {});
+
+  auto gen = generation_;
+  auto done = [this, blk, count, gen] (buffer_t buf) {
+    fetched(blk, count, buf, gen);
+  };
+  if (count == 1)
+    device_.read(blk, done);
+  else
+    device_.read(blk, count, done);
+}
+
+BlockCache::buffer_t BlockCache::copy_block(const uint8_t* data) const
+{
+  const auto bs = block_size();
+  auto block = buffer_t(new uint8_t[bs], std::default_delete<uint8_t[]>());
+  memcpy(block.get(), data, bs);
+  return block;
+}
+
+void BlockCache::fetched(block_t blk, block_t count, buffer_t buf, uint32_t gen)
+{
+  const auto bs = block_size();
+  for (block_t i = 0; i < count; i++) {
+    // A block of its own, so that what's cached is all that's kept
+    buffer_t block;
+    if (buf)
+      block = (count == 1) ? buf : copy_block(buf.get() + i * bs);
+
+    std::vector<on_read_func> waiting;
+    if (auto* w = pending_.find(blk + i)) {
+      waiting = std::move(*w);
+      pending_.erase(blk + i);
+    }
+
+    if (block and gen == generation_)
+      insert(blk + i, block, not waiting.empty());
+
+    for (auto& func : waiting)
+      func(block);
+  }
+}
+
+} //< namespace hw
@@ -22,6 +22,8 @@
 
 #include <hw/ide.hpp>
 
+#include <cstring>
+
 #include <kernel/irq_manager.hpp>
 #include <kernel/syscalls.hpp>
 
@@ -137,11 +139,25 @@ void IDE::read(block_t blk, on_read_func callback) {
 
 void IDE::read(block_t blk, block_t count, on_read_func callback)
 {
-  if (blk + count >= _nb_blk) {
+  if (blk + count > _nb_blk or count == 0) {
     // avoid reading past the disk boundaries
     callback(buffer_t());
     return;
   }
+
+  // like read() above, one sector at a time, but all of them in one buffer
+  auto* buffer = new uint8_t[count * block_size()];
+  for (block_t i = 0; i < count; i++) {
+    auto sector = read_sync(blk + i);
+    if (not sector) {
+      delete[] buffer;
+      callback(buffer_t());
+      return;
+    }
+    memcpy(buffer + i * block_size(), sector.get(), block_size());
+  }
+  callback(buffer_t(buffer, std::default_delete<uint8_t[]>()));
+  return;
   
   set_irq_mode(true);
   set_drive(0xE0 | (_drive << 4) | ((blk >> 24) & 0x0F));
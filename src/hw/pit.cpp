@@ -49,15 +49,14 @@ uint64_t PIT::millisec_counter = 0;
 // The default recurring timer condition
 std::function<bool()> PIT::forever = []{ return true; };
 
-// Timer ID's
-uint32_t PIT::Timer::timers_count_ = 0;
-
 using namespace std::chrono;
 
-
-
-PIT::Timer::Timer(Type t, timeout_handler handler, std::chrono::milliseconds ms, repeat_condition cond)
-  : type_{t}, id_{++timers_count_}, handler_{handler}, interval_{ms}, cond_{cond} {};
+constexpr PIT::timer_id PIT::NO_TIMER;
+constexpr uint32_t PIT::NIL;
+constexpr uint16_t PIT::EXPIRING;
+constexpr uint16_t PIT::RUNNING;
+constexpr uint16_t PIT::FREE;
+constexpr uint64_t PIT::NO_DEADLINE;
 
 
 void PIT::disable_regular_interrupts()
@@ -70,6 +69,9 @@ PIT::~PIT(){}
 PIT::PIT(){
   debug("<PIT> Instantiating. \n");
 
+  for (auto& head : wheel_)
+    head = NIL;
+
   auto handler(IRQ_manager::irq_delegate::from<PIT,&PIT::irq_handler>(this));
 
   IRQ_manager::subscribe(0, handler);
@@ -111,132 +113,334 @@ MHz PIT::CPUFrequency(){
 }
 
 
-void PIT::start_timer(Timer t, std::chrono::milliseconds in_msecs){
+void PIT::start_timer(uint32_t index, std::chrono::milliseconds in_msecs){
   if (in_msecs < 1ms) panic("Can't wait less than 1 ms. ");
 
+  auto& t = timers_[index];
+
+  if (tickless_) {
+    update_clock();
+    t.expires = millisec_counter + in_msecs.count();
+    insert(index);
+
+    // Sooner than the PIT is set to go off (never, while timers run)
+    if (t.expires < next_deadline_)
+      program_next();
+
+    debug("<PIT start_timer> Tickless. Expires: %i index: %i. There are %i timers. \n",
+	  (uint32_t)t.expires, index, active_timers_);
+    return;
+  }
+
   if (current_mode_ != RATE_GEN)
     set_mode(RATE_GEN);
 
   if (current_freq_divider_ != millisec_interval)
     set_freq_divider(millisec_interval);
 
-  auto cycles_pr_millisec = KHz(CPUFrequency());
-  debug("<PIT start_timer> CPU KHz: %f Cycles to wait: %f \n",cycles_pr_millisec.count(), cycles_pr_millisec.count() * in_msecs);
-
   auto ticks = in_msecs / KHz(current_frequency()).count();
   debug("<PIT start_timer> PIT KHz: %f * %i = %f ms. \n",
 	KHz(current_frequency()).count(), (uint32_t)ticks.count(), ((uint32_t)ticks.count() * KHz(current_frequency()).count()));
 
-  t.setStart(OS::cycles_since_boot());
-  t.setEnd(t.start() + uint64_t(cycles_pr_millisec.count() * in_msecs.count()));
-
+  t.expires = millisec_counter + ticks.count();
+  insert(index);
 
-  auto key = millisec_counter + ticks.count();
+  debug("<PIT start_timer> Expires: %i index: %i. There are %i timers. \n",
+	(uint32_t)t.expires, index, active_timers_);
+}
 
-  // We could emplace, but the timer exists allready, and might be a reused one
-  timers_.insert(std::make_pair(key, t));
+PIT::timer_id PIT::add_timer(Timer::Type type, timeout_handler handler,
+                             std::chrono::milliseconds ms, repeat_condition cond){
+  uint32_t index;
+
+  // Reuse a released timer, or make a new one
+  if (free_timers_ != NIL) {
+    index = free_timers_;
+    free_timers_ = timers_[index].next;
+  } else {
+    index = timers_.size();
+    timers_.emplace_back();
+  }
 
-  debug("<PIT start_timer> Key: %i id: %i, t.cond()(): %s There are %i timers. \n",
-	(uint32_t)key, t.id(), t.cond()() ? "true" : "false", timers_.size());
+  auto& t = timers_[index];
+  t.type = type;
+  t.handler = handler;
+  t.cond = std::move(cond);
+  t.interval = ms;
+
+  // The wheel stands still while there are no timers
+  if (not active_timers_) {
+    if (tickless_)
+      update_clock();
+    wheel_ms_ = millisec_counter + 1;
+  }
 
+  active_timers_++;
+  start_timer(index, ms);
 
+  return make_id(index, t.generation);
 }
 
-void PIT::onRepeatedTimeout(std::chrono::milliseconds ms, timeout_handler handler, repeat_condition cond){
-  debug("<PIT repeated> setting a %i ms. repeating timer \n", (uint32_t)ms.count());
+void PIT::stop_timer(timer_id id){
+  uint32_t index = id & UINT32_MAX;
+  uint32_t generation = id >> 32;
 
-  Timer t(Timer::REPEAT_WHILE, handler, ms, cond);
-  start_timer(t, ms);
-};
+  // Already done, or never was
+  if (index >= timers_.size() or timers_[index].generation != generation)
+    return;
 
+  auto& t = timers_[index];
 
-void PIT::onTimeout(std::chrono::milliseconds msec, timeout_handler handler){
-  Timer t(Timer::ONE_SHOT, handler, msec);
+  // It's running its handler right now; just don't requeue it
+  if (t.list == RUNNING) {
+    t.type = Timer::ONE_SHOT;
+    return;
+  }
 
-  debug("<PIT timeout> setting a %i ms. one-shot timer. Id: %i \n",
-	(uint32_t)msec.count(), t.id());
+  debug2("<PIT stop_timer> Stopping timer %i \n", index);
+  unlink(index);
+  release(index);
+}
 
-  start_timer(t, msec);
+void PIT::link(uint32_t index, uint16_t list){
+  auto& t = timers_[index];
+  t.list = list;
+  t.prev = NIL;
+  t.next = wheel_[list];
+  if (t.next != NIL)
+    timers_[t.next].prev = index;
+  wheel_[list] = index;
+}
 
-};
+void PIT::unlink(uint32_t index){
+  auto& t = timers_[index];
+  if (t.prev != NIL)
+    timers_[t.prev].next = t.next;
+  else
+    wheel_[t.list] = t.next;
+  if (t.next != NIL)
+    timers_[t.next].prev = t.prev;
+}
 
+void PIT::release(uint32_t index){
+  auto& t = timers_[index];
 
-uint8_t PIT::read_back(uint8_t){
-  const uint8_t READ_BACK_CMD = 0xc2;
+  // Let go of anything captured by the handler / condition now
+  t.handler = timeout_handler{};
+  t.cond = nullptr;
+  t.generation++;
+  t.list = FREE;
+  t.next = free_timers_;
+  free_timers_ = index;
 
-  hw::outb(PIT_mode_register, READ_BACK_CMD );
+  active_timers_--;
 
-  auto res = hw::inb(PIT_chan0);
+  // If this was the last timer, we can turn off the clock. 
+  // A pending one-shot just goes off once more.
+  if (not active_timers_ and not tickless_) {
+    oneshot(1);
+    debug2 ("Timers done. PIT disabled for now. \n");
+  }
+}
 
-  debug("STATUS: %#x \n", res);
+void PIT::insert(uint32_t index){
+  auto expires = timers_[index].expires;
+  int64_t delta = expires - wheel_ms_;
+  uint16_t slot;
+
+  if (delta < 0) {
+    // Late. Take it on the next tick.
+    slot = wheel_ms_ & WHEEL_MASK;
+  } else if (delta < WHEEL_SIZE) {
+    slot = expires & WHEEL_MASK;
+  } else {
+    // Further out than the wheel reaches: park it in the last slot, and
+    // it will be reinserted from there
+    const int64_t max_delta = (1LL << (WHEEL_BITS * LEVELS)) - 1;
+    if (delta > max_delta)
+      expires = wheel_ms_ + max_delta;
+
+    int level = 1;
+    while (level < LEVELS - 1 and delta >= (1LL << (WHEEL_BITS * (level + 1))))
+      level++;
+
+    slot = level * WHEEL_SIZE + ((expires >> (WHEEL_BITS * level)) & WHEEL_MASK);
+  }
 
-  return res;
+  link(index, slot);
+}
 
+int PIT::cascade(int level){
+  int slot = (wheel_ms_ >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  auto& head = wheel_[level * WHEEL_SIZE + slot];
+
+  // Take the whole list, and let each timer find its place again
+  auto index = head;
+  head = NIL;
+  while (index != NIL) {
+    auto next = timers_[index].next;
+    insert(index);
+    index = next;
+  }
+  return slot;
 }
 
-void PIT::irq_handler(){
+void PIT::run_timers(){
 
-  IRQ_counter_ ++;
+  while (wheel_ms_ <= millisec_counter) {
+    int slot = wheel_ms_ & WHEEL_MASK;
 
-  if (current_freq_divider_ == millisec_interval)
-    millisec_counter++;
+    // A lap of a level is done, bring down the next slot of the level above
+    for (int level = 1; slot == 0 and level < LEVELS; level++)
+      slot = cascade(level);
 
-  #ifdef DEBUG
-  if (millisec_counter % 100 == 0)
-    OS::rsprint(".");
-  #endif
+    slot = wheel_ms_ & WHEEL_MASK;
+    wheel_ms_++;
 
-  // Iterate over expired timers (we break on the first non-expired)
-  for (auto it = timers_.begin(); it != timers_.end(); it++) {
+    // Everything expiring on this tick, in one go
+    wheel_[EXPIRING] = wheel_[slot];
+    wheel_[slot] = NIL;
+    for (auto index = wheel_[EXPIRING]; index != NIL; index = timers_[index].next)
+      timers_[index].list = EXPIRING;
 
-    // Map-keys are sorted. If this timer isn't expired, neither are the rest
-    if (it->first > millisec_counter)
-      break;
+    while (wheel_[EXPIRING] != NIL) {
+      auto index = wheel_[EXPIRING];
+      unlink(index);
+      timers_[index].list = RUNNING;
 
-    debug2 ("\n**** Timer type %i, id: %i expired. Running handler **** \n",
-	    it->second.type(), it->second.id());
+      debug2 ("\n**** Timer type %i, index: %i expired. Running handler **** \n",
+	      timers_[index].type, index);
 
-    // Execute the handler
-    it->second.handler()();
+      // Handlers may start timers, but the deque keeps this one in place
+      auto handler = timers_[index].handler;
+      handler();
 
-    // Re-queue repeating timers
-    if (it->second.type() == Timer::REPEAT) {
-      debug2 ("<Timer IRQ> REPEAT: Requeuing the timer \n");
-      start_timer(it->second, it->second.interval());
+      auto& t = timers_[index];
 
-    }else if (it->second.type() == Timer::REPEAT_WHILE and it->second.cond()()) {
-      debug2 ("<Timer IRQ> REPEAT_WHILE: Requeuing the timer COND \n");
-      start_timer(it->second, it->second.interval());
+      // Re-queue repeating timers
+      if (t.type == Timer::REPEAT
+          or (t.type == Timer::REPEAT_WHILE and t.cond())) {
+        debug2 ("<Timer IRQ> Requeuing the timer \n");
+        start_timer(index, t.interval);
+      } else {
+        release(index);
+      }
     }
+  }
+}
+
+void PIT::update_clock(){
+  auto now = OS::cycles_since_boot();
+
+  // Pick up from wherever the counter is
+  if (not cycles_per_ms_) {
+    cycles_per_ms_ = KHz(CPUFrequency()).count();
+    tsc_base_ = now - millisec_counter * cycles_per_ms_;
+  }
+
+  millisec_counter = (now - tsc_base_) / cycles_per_ms_;
+}
 
-    debug2 ("Timer done. Erasing.  \n");
+uint64_t PIT::next_expiry() const {
+  for (auto ms = wheel_ms_; ; ms++) {
+    // Start of a lap; timers from the levels above come down
+    if ((ms & WHEEL_MASK) == 0 or wheel_[ms & WHEEL_MASK] != NIL)
+      return ms;
+  }
+}
 
-    // Escape iterator death
-    auto remove = it;
-    it++;
+void PIT::program_next(){
+  if (not active_timers_) {
+    next_deadline_ = NO_DEADLINE;
+    debug2("<PIT> No timers. Not setting up a one-shot. \n");
+    return;
+  }
 
-    // Erase the timer
-    timers_.erase(remove);
+  auto next = next_expiry();
+  uint64_t delta = next > millisec_counter ? next - millisec_counter : 1;
 
-    // If this was the last timer, we can turn off the clock
-    if (timers_.empty()){
-      // Disable the PIT
-      oneshot(1);
+  // Beyond what the PIT can count to, we'll just have to look again
+  if (delta > max_oneshot_ms)
+    delta = max_oneshot_ms;
 
-      debug2 ("Timers done. PIT disabled for now. \n");
-      // Escape iterator death
-      break;
+  next_deadline_ = millisec_counter + delta;
+  debug2("<PIT> One-shot in %i ms. \n", (uint32_t)delta);
+
+  oneshot(delta * millisec_interval);
+}
+
+void PIT::set_tickless(bool on){
+  if (on == tickless_)
+    return;
+
+  tickless_ = on;
+
+  if (on) {
+    // Time keeping moves over to the TSC
+    cycles_per_ms_ = 0;
+    update_clock();
+    program_next();
+  } else {
+    next_deadline_ = NO_DEADLINE;
+    if (active_timers_) {
+      set_mode(RATE_GEN);
+      set_freq_divider(millisec_interval);
     }
+  }
+}
 
-    debug2 ("Timers left: %i \n", timers_.size());
+PIT::timer_id PIT::onRepeatedTimeout(std::chrono::milliseconds ms, timeout_handler handler, repeat_condition cond){
+  debug("<PIT repeated> setting a %i ms. repeating timer \n", (uint32_t)ms.count());
+
+  return add_timer(Timer::REPEAT_WHILE, handler, ms, cond);
+};
 
-    #ifdef DEBUG2
-    for (auto t : timers_)
-      debug2("Key: %i , id: %i, Type: %i", (uint32_t)t.first, t.second.id(), t.second.type());
-    #endif
 
-    debug2("\n---------------------------\n\n");
+PIT::timer_id PIT::onTimeout(std::chrono::milliseconds msec, timeout_handler handler){
+  debug("<PIT timeout> setting a %i ms. one-shot timer. \n",
+	(uint32_t)msec.count());
+
+  return add_timer(Timer::ONE_SHOT, handler, msec, nullptr);
+};
+
+
+uint8_t PIT::read_back(uint8_t){
+  const uint8_t READ_BACK_CMD = 0xc2;
+
+  hw::outb(PIT_mode_register, READ_BACK_CMD );
+
+  auto res = hw::inb(PIT_chan0);
+
+  debug("STATUS: %#x \n", res);
+
+  return res;
+
+}
+
+void PIT::irq_handler(){
+
+  IRQ_counter_ ++;
+
+  if (tickless_) {
+    // Handlers starting timers shouldn't reprogram; we do that below
+    next_deadline_ = 0;
+    update_clock();
   }
+  else if (current_freq_divider_ == millisec_interval)
+    millisec_counter++;
+
+  #ifdef DEBUG
+  if (millisec_counter % 100 == 0)
+    OS::rsprint(".");
+  #endif
+
+  if (active_timers_)
+    run_timers();
+  else
+    wheel_ms_ = millisec_counter + 1;
+
+  if (tickless_)
+    program_next();
 
   // All IRQ-handlers has to send EOI
   IRQ_manager::eoi(0);
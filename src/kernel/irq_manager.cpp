@@ -37,6 +37,8 @@ irq_bitfield IRQ_manager::irq_subscriptions {0};
 
 void (*IRQ_manager::irq_subscribers[sizeof(irq_bitfield)*8])() {nullptr};
 IRQ_manager::irq_delegate IRQ_manager::irq_delegates[sizeof(irq_bitfield)*8];
+std::vector<IRQ_manager::irq_delegate> IRQ_manager::deferred_;
+std::vector<IRQ_manager::irq_delegate> IRQ_manager::deferred_work_;
 
 void IRQ_manager::enable_interrupts() {
   __asm__ volatile("sti");
@@ -351,12 +353,26 @@ void IRQ_manager::notify() {
     todo = (irq_subscriptions & irq_pending);
   }
 
+  // Deferred work. If there is any, don't sleep - there may be more.
+  if (not deferred_.empty()) {
+    // Delegates may defer again, so work on the other vector
+    deferred_work_.swap(deferred_);
+    for (auto& del : deferred_work_)
+      del();
+    deferred_work_.clear();
+    return;
+  }
+
   //hlt
   debug("<IRQ notify> Done. OS going to sleep.\n");
   //__asm__("sti");
   __asm__ volatile("hlt;");
 }
 
+void IRQ_manager::defer(irq_delegate del) {
+  deferred_.push_back(del);
+}
+
 void IRQ_manager::eoi(uint8_t irq) {
 	hw::PIC::eoi(irq);
 }
@@ -70,9 +70,12 @@ void Arp::bottom(Packet_ptr pckt) {
     auto waiting = waiting_packets_.find(hdr->sipaddr);
 
     if (waiting != waiting_packets_.end()) {
-	    debug("Had a packet waiting for this IP. Sending\n");
-	    transmit(waiting->second);
+	    debug("Had %i packets waiting for this IP. Sending\n", waiting->second.size());
+	    // Move them out first, in case transmit ends up back here
+	    auto packets = std::move(waiting->second);
 	    waiting_packets_.erase(waiting);
+	    for (auto& pckt : packets)
+	      transmit(pckt);
     }
     break;
   }
@@ -189,15 +192,10 @@ void Arp::transmit(Packet_ptr pckt) {
 }
 
 void Arp::await_resolution(Packet_ptr pckt, IP4::addr) {
-  auto queue =  waiting_packets_.find(pckt->next_hop());
+  auto& queue = waiting_packets_[pckt->next_hop()];
 
-  if (queue != waiting_packets_.end()) {
-    debug("<ARP Resolve> Packets already queueing for this IP\n");
-    queue->second->chain(pckt);    
-  } else {
-    debug("<ARP Resolve> This is the first packet going to that IP\n");
-    waiting_packets_.emplace(std::make_pair(pckt->next_hop(), pckt));
-  }            
+  debug("<ARP Resolve> %i packets already queueing for this IP\n", queue.size());
+  queue.push_back(pckt);
 }
 
 void Arp::arp_resolve(Packet_ptr pckt) {
@@ -24,61 +24,101 @@
 
 namespace net {
 
-BufferStore::BufferStore(size_t num, size_t bufsize, size_t device_offset ) :
+BufferStore::BufferStore(size_t num, size_t bufsize, size_t device_offset, size_t max_bufs) :
   bufcount_      {num},
   bufsize_       {bufsize},
   device_offset_ {device_offset},
-  pool_          {static_cast<buffer_t>(memalign(PAGE_SIZE, num * bufsize))}
+  max_bufs_      {num * MAX_POOLS}
 {
-  assert(pool_);
-
   debug ("<BufferStore> Creating buffer store of %i * %i bytes.\n",
 	      num, bufsize);
 
-  for (buffer_t b = pool_; b < pool_ + (num * bufsize); b += bufsize)
-    available_buffers_.push_back(b);
+  if (max_bufs)
+    set_max_buffers(max_bufs);
+
+  if (not increaseStorage())
+    panic("<BufferStore> Couldn't allocate the initial pool.\n");
 
   debug ("<BufferStore> I now have %i free buffers in range %p -> %p.\n",
-	 available_buffers_.size(), pool_, pool_ + (bufcount_ * bufsize_));
+	 available_, pools_[0], pools_[0] + (bufcount_ * bufsize_));
 }
 
 BufferStore::~BufferStore() {
-  free(pool_);
+  for (size_t i = 0; i < pool_count_; ++i)
+    free(pools_[i]);
+}
+
+void BufferStore::set_max_buffers(size_t max_bufs) noexcept {
+  // Never less than what we've got, never more than MAX_POOLS pools
+  auto pools = max_bufs / bufcount_;
+  if (pools < pool_count_) pools = pool_count_;
+  if (pools > MAX_POOLS)   pools = MAX_POOLS;
+  if (pools < 1)           pools = 1;
+  max_bufs_ = pools * bufcount_;
+}
+
+bool BufferStore::increaseStorage() {
+  if (total_buffers() + bufcount_ > max_bufs_) {
+    debug("<BufferStore> Storage ceiling (%i buffers) reached.\n", max_bufs_);
+    return false;
+  }
+
+  auto pool = static_cast<buffer_t>(memalign(PAGE_SIZE, bufcount_ * bufsize_));
+  if (not pool) {
+    debug("<BufferStore> Out of memory for another pool.\n");
+    return false;
+  }
+
+  pools_[pool_count_++] = pool;
+
+  // Push in reverse, so that the pool is handed out front to back
+  for (size_t i = bufcount_; i > 0; --i)
+    push_free(pool + (i - 1) * bufsize_);
+
+  debug("<BufferStore> Added pool #%i @ %p. %i buffers in total.\n",
+        pool_count_, pool, total_buffers());
+  return true;
 }
 
-/**
- * @todo : We (think we) want a list of pools, that we increase as needed.
- */
-void BufferStore::increaseStorage() {
-  panic("<BufferStore> Storage pool full! Don't know how to increase pool size yet.\n");
+void BufferStore::check_watermark() {
+  if (low()) {
+    if (not watermark_fired_) {
+      watermark_fired_ = true;
+      on_low_watermark_(*this);
+    }
+  } else {
+    watermark_fired_ = false;
+  }
 }
 
 BufferStore::buffer_t BufferStore::get_raw_buffer() {
-  if (available_buffers_.empty())
-    increaseStorage();
+  if (not free_list_ and not increaseStorage())
+    return nullptr;
+
+  auto buf = pop_free();
 
-  auto buf = available_buffers_.front();
-  available_buffers_.pop_front();  
-  
   debug2("<BufferStore> Provisioned a buffer. %i buffers remaining.\n",
-	available_buffers_.size());
+	available_);
 
+  check_watermark();
   return buf;
 }
 
 BufferStore::buffer_t BufferStore::get_offset_buffer() {
-  return get_raw_buffer() + device_offset_;
+  auto buf = get_raw_buffer();
+  return buf ? buf + device_offset_ : nullptr;
 }
 
 void BufferStore::release_raw_buffer(buffer_t b, size_t bufsize) {
   debug2("<BufferStore> Trying to release %i sized buffer @%p.\n", bufsize, b);
   // Make sure the buffer comes from here. Otherwise, ignore it.
-  if (address_is_from_pool(b) 
+  if (address_is_from_pool(b)
       and address_is_bufstart(b)
       and bufsize == bufsize_)
     {
-      available_buffers_.push_back(b);
-      debug("<BufferStore> Releasing %p. %i available buffers.\n", b, available_buffers_.size());
+      push_free(b);
+      debug("<BufferStore> Releasing %p. %i available buffers.\n", b, available_);
+      check_watermark();
       return;
     }
 
@@ -88,12 +128,13 @@ void BufferStore::release_raw_buffer(buffer_t b, size_t bufsize) {
 void BufferStore::release_offset_buffer(buffer_t b, size_t bufsize) {
   debug2("<BufferStore> Trying to release %i + %i sized buffer @%p.\n", bufsize, device_offset_, b);
   // Make sure the buffer comes from here. Otherwise, ignore it.
-  if (address_is_from_pool(b) 
+  if (address_is_from_pool(b)
       and address_is_offset_bufstart(b)
       and bufsize == bufsize_ - device_offset_)
     {
-      available_buffers_.push_back(b - device_offset_);
-      debug("<BufferStore> Releasing %p. %i available buffers.\n", b, available_buffers_.size());
+      push_free(b - device_offset_);
+      debug("<BufferStore> Releasing %p. %i available buffers.\n", b, available_);
+      check_watermark();
       return;
     }
 
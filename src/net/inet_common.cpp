@@ -43,7 +43,11 @@ uint16_t checksum(void* data, size_t len) noexcept {
     sum32.whole += reinterpret_cast<uint8_t*>(buf)[len - 1];
   }
 
-  return ~(sum32.part[0] + sum32.part[1]);
+  // Fold the carries back in
+  while (sum32.part[1])
+    sum32.whole = sum32.part[0] + sum32.part[1];
+
+  return ~sum32.part[0];
 }
 
 } //< namespace net
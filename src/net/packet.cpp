@@ -18,10 +18,110 @@
 //#define DEBUG
 
 #include <os>
+#include <new>
+#include <memory>
+#include <malloc.h>
 #include <net/packet.hpp>
 
 namespace net {
 
+namespace {
+
+/**
+ *  Fixed-size slots, recycled through an intrusive freelist.
+ *
+ *  Slots are carved out of chunks which are never given back, so once
+ *  the chunks cover the number of packets in flight, creating a packet
+ *  is a pointer pop and destroying it is a pointer push.
+ */
+template <size_t Size, size_t Align>
+class Slab {
+public:
+  static constexpr size_t CHUNK {256};
+
+  static void* get() {
+    if (not free_ and not grow())
+      throw std::bad_alloc();
+
+    auto* s = free_;
+    free_ = s->next;
+    return s;
+  }
+
+  static void put(void* p) noexcept {
+    auto* s = static_cast<slot*>(p);
+    s->next = free_;
+    free_ = s;
+  }
+
+private:
+  union slot {
+    slot* next;
+    alignas(Align) char storage[Size];
+  };
+
+  static bool grow() {
+    auto* chunk = static_cast<slot*>(memalign(alignof(slot), CHUNK * sizeof(slot)));
+    if (not chunk)
+      return false;
+
+    debug("<Packet> Adding %i slots of %i bytes to the packet slab\n", CHUNK, sizeof(slot));
+    for (size_t i = CHUNK; i > 0; --i)
+      put(&chunk[i - 1]);
+    return true;
+  }
+
+  static slot* free_;
+};
+
+template <size_t Size, size_t Align>
+typename Slab<Size, Align>::slot* Slab<Size, Align>::free_ {nullptr};
+
+/**
+ *  Allocator for std::allocate_shared. The standard library rebinds it
+ *  to its own control block type, so the slab is sized for the whole
+ *  refcount + Packet block.
+ */
+template <typename T>
+struct Slab_allocator {
+  using value_type = T;
+  using slab = Slab<sizeof(T), alignof(T)>;
+
+  Slab_allocator() noexcept = default;
+
+  template <typename U>
+  Slab_allocator(const Slab_allocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    if (n == 1)
+      return static_cast<T*>(slab::get());
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    if (n == 1)
+      slab::put(p);
+    else
+      ::operator delete(p);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const Slab_allocator<T>&, const Slab_allocator<U>&) noexcept
+{ return true; }
+
+template <typename T, typename U>
+bool operator!=(const Slab_allocator<T>&, const Slab_allocator<U>&) noexcept
+{ return false; }
+
+} //< anonymous namespace
+
+Packet_ptr Packet::create(BufferStore::buffer_t buf, size_t bufsize, size_t datalen,
+                          release_del rel)
+{
+  return std::allocate_shared<Packet>(Slab_allocator<Packet>{}, buf, bufsize, datalen, rel);
+}
+
 Packet::Packet(BufferStore::buffer_t buf, size_t bufsize, size_t datalen, release_del rel) noexcept:
   buf_       {buf},
   capacity_  {bufsize},
@@ -55,9 +155,53 @@ int Packet::set_size(const size_t size) noexcept {
   return size_;
 }
 
+void Packet::complete_checksum() noexcept {
+  if (not csum_partial())
+    return;
+
+  // The checksum field holds the pseudo header sum, so summing it along
+  // with the rest gives the full checksum
+  auto* field = reinterpret_cast<uint16_t*>(buf_ + csum_start_ + csum_offset_);
+  if (not chain_) {
+    *field = net::checksum(buf_ + csum_start_, size_ - csum_start_);
+    offload_flags_ &= ~CSUM_PARTIAL;
+    return;
+  }
+
+  // Chained buffers continue the payload, and may split a 16-bit word
+  uint32_t sum = 0;
+  bool odd = false;
+  auto add = [&sum, &odd] (const uint8_t* data, size_t len) {
+    if (odd and len) {
+      sum += data[0] << 8;
+      data++;
+      len--;
+      odd = false;
+    }
+    for (size_t i = 0; i + 1 < len; i += 2)
+      sum += *reinterpret_cast<const uint16_t*>(data + i);
+    if (len & 1) {
+      sum += data[len - 1];
+      odd = true;
+    }
+    while (sum >> 16)
+      sum = (sum & 0xffff) + (sum >> 16);
+  };
+
+  add(buf_ + csum_start_, size_ - csum_start_);
+  for (auto* p = chain_.get(); p; p = p->chain_.get())
+    add(p->buf_, p->size_);
+
+  *field = ~sum;
+  offload_flags_ &= ~CSUM_PARTIAL;
+}
+
 void default_release(BufferStore::buffer_t b, size_t) {
   (void) b;
   debug("<Packet DEFAULT RELEASE> Ignoring buffer.");
 }
 
+void no_release(BufferStore::buffer_t, size_t)
+{}
+
 } //< namespace net
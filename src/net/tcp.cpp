@@ -18,6 +18,8 @@
 #define DEBUG2
 
 #include <net/tcp.hpp>
+#include <net/tcp_congestion.hpp>
+#include <net/ethernet.hpp>
 
 using namespace std;
 using namespace net;
@@ -27,7 +29,12 @@ TCP::TCP(IPStack& inet) :
 	inet_(inet),
 	listeners_(),
 	connections_(),
-	MAX_SEG_LIFETIME(30s)
+	MAX_SEG_LIFETIME(30s),
+	MIN_RTO(200ms),
+	DELAYED_ACK(40ms),
+	SACK(true),
+	TIMESTAMPS(true),
+	WINDOW_SIZE(default_window_size)
 {
 
 }
@@ -94,30 +101,41 @@ TCP::Port TCP::free_port() {
 }
 
 
-uint16_t TCP::checksum(TCP::Packet_ptr packet) {
-	// TCP header
-	TCP::Header* tcp_hdr = &(packet->header());
-	// Pseudo header
+uint16_t TCP::pseudo_header_sum(TCP::Packet_ptr packet) {
 	TCP::Pseudo_header pseudo_hdr;
 
-	int tcp_length = packet->tcp_length();
-
 	pseudo_hdr.saddr.whole = packet->src().whole;
 	pseudo_hdr.daddr.whole = packet->dst().whole;
 	pseudo_hdr.zero = 0;
 	pseudo_hdr.proto = IP4::IP4_TCP;	 
-	pseudo_hdr.tcp_length = htons(tcp_length);
+	// Includes any chained payload (TSO / LRO)
+	pseudo_hdr.tcp_length = htons(packet->tcp_length());
+
+	uint32_t sum = 0;
+	for (uint16_t* it = (uint16_t*)&pseudo_hdr; it < (uint16_t*)&pseudo_hdr + sizeof(pseudo_hdr)/2; it++)
+		sum += *it;
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return sum;
+}
+
+uint16_t TCP::checksum(TCP::Packet_ptr packet) {
+	// TCP header
+	TCP::Header* tcp_hdr = &(packet->header());
+
+	// Only this packet's own buffer. Chained payload (TSO / LRO, zero-copy
+	// writes) is checksummed by the NIC, or Packet::complete_checksum.
+	int tcp_length = packet->header_size() + packet->buffer_data_length();
 
 	union {
 		uint32_t whole;
 		uint16_t part[2];
 	} sum;
 
-	sum.whole = 0;
-
-	// Compute sum of pseudo header
-	for (uint16_t* it = (uint16_t*)&pseudo_hdr; it < (uint16_t*)&pseudo_hdr + sizeof(pseudo_hdr)/2; it++)
-		sum.whole += *it;       
+	// Start with the sum of the pseudo header
+	sum.whole = pseudo_header_sum(packet);
 
 	// Compute sum sum the actual header and data
 	for (uint16_t* it = (uint16_t*)tcp_hdr; it < (uint16_t*)tcp_hdr + tcp_length/2; it++)
@@ -135,10 +153,14 @@ uint16_t TCP::checksum(TCP::Packet_ptr packet) {
 		sum.whole += last_chunk.whole;
 	}
 
-	debug2("<TCP::checksum: sum: 0x%x, half+half: 0x%x, TCP checksum: 0x%x, TCP checksum big-endian: 0x%x \n",
-	 sum.whole, sum.part[0] + sum.part[1], (uint16_t)~((uint16_t)(sum.part[0] + sum.part[1])), htons((uint16_t)~((uint16_t)(sum.part[0] + sum.part[1]))));
+	// Fold the carries back in
+	while (sum.part[1])
+		sum.whole = sum.part[0] + sum.part[1];
+
+	debug2("<TCP::checksum: sum: 0x%x, TCP checksum: 0x%x, TCP checksum big-endian: 0x%x \n",
+	 sum.whole, (uint16_t)~sum.part[0], htons((uint16_t)~sum.part[0]));
 
-	return ~(sum.part[0] + sum.part[1]);
+	return ~sum.part[0];
 }
 
 void TCP::bottom(net::Packet_ptr packet_ptr) {
@@ -147,19 +169,21 @@ void TCP::bottom(net::Packet_ptr packet_ptr) {
 	debug("<TCP::bottom> TCP Packet received - Source: %s, Destination: %s \n", 
 			packet->source().to_string().c_str(), packet->destination().to_string().c_str());
 	
-	// Do checksum
-	if(checksum(packet)) {
+	// Do checksum, unless the NIC already did
+	if(not packet->csum_verified() and checksum(packet)) {
 		debug("<TCP::bottom> TCP Packet Checksum != 0 \n");
 	}
 
 	Connection::Tuple tuple { packet->dst_port(), packet->source() };
 
 	// Try to find the receiver
-	auto conn_it = connections_.find(tuple);
+	auto found = connections_.find(tuple);
 	// Connection found
-	if(conn_it != connections_.end()) {
-		debug("<TCP::bottom> Connection found: %s \n", conn_it->second->to_string().c_str());
-		conn_it->second->receive(packet);
+	if(found) {
+		// Hold on to it; receiving may close (and remove) the connection
+		auto conn = *found;
+		debug("<TCP::bottom> Connection found: %s \n", conn->to_string().c_str());
+		conn->receive(packet);
 	}
 	// No connection found 
 	else {
@@ -170,7 +194,9 @@ void TCP::bottom(net::Packet_ptr packet_ptr) {
 		if(listen_conn_it != listeners_.end()) {
 			auto& listen_conn = listen_conn_it->second;
 			debug("<TCP::bottom> Listener found: %s ...\n", listen_conn.to_string().c_str());
-			auto connection = (connections_.emplace(tuple, std::make_shared<Connection>(listen_conn)).first->second);
+			auto connection = *(connections_.emplace(tuple, std::make_shared<Connection>(listen_conn)).first);
+			// Same kind of congestion control as the listener, but its own
+			connection->set_congestion_control(listen_conn.congestion_control().clone());
 			// Set remote
 			connection->set_remote(packet->source());
 			debug("<TCP::bottom> ... Creating connection: %s \n", connection->to_string().c_str());
@@ -215,10 +241,10 @@ string TCP::status() const {
 }*/
 
 TCP::Connection_ptr TCP::add_connection(Port local_port, TCP::Socket remote) {
-	return 	(connections_.emplace(
+	return 	*(connections_.emplace(
 				Connection::Tuple{ local_port, remote }, 
 				std::make_shared<Connection>(*this, local_port, remote))
-			).first->second;
+			).first;
 }
 
 void TCP::close_connection(TCP::Connection& conn) {
@@ -227,14 +253,27 @@ void TCP::close_connection(TCP::Connection& conn) {
 	debug2("<TCP::close_connection> TCP Status: \n%s \n", status().c_str());
 }
 
+uint16_t TCP::MSS() const {
+	// From the link MTU; the driver's MTU() is the size of its buffers
+	return Ethernet::MAXIMUM_PAYLOAD - sizeof(IP4::ip_header) - sizeof(TCP::Header);
+}
+
 void TCP::drop(TCP::Packet_ptr) {
 	//debug("<TCP::drop> Packet was dropped - no recipient: %s \n", packet->destination().to_string().c_str());
 }
 
 void TCP::transmit(TCP::Packet_ptr packet) {
 	// Translate into a net::Packet_ptr and send away.
-	// Generate checksum.
-	packet->set_checksum(TCP::checksum(packet));
-	//packet->set_checksum(checksum(packet));
+	// Generate checksum, or leave all but the pseudo header to the NIC.
+	// Chained payload is summed by the NIC, or Packet::complete_checksum.
+	if(inet_.checksum_offload() or packet->unchain()) {
+		packet->set_checksum(pseudo_header_sum(packet));
+		packet->set_csum_partial((uint8_t*)&packet->header() - packet->buffer(),
+			offsetof(TCP::Header, checksum));
+	}
+	else {
+		packet->set_checksum(0);
+		packet->set_checksum(TCP::checksum(packet));
+	}
 	_network_layer_out(packet);
 }
@@ -0,0 +1,237 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015-2016 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//#define DEBUG
+//#define DEBUG2
+
+#include <net/tcp_congestion.hpp>
+#include <cmath>
+
+using namespace net;
+using Congestion_control = TCP::Congestion_control;
+
+/////////////////// CONGESTION CONTROL ///////////////////
+
+/*
+	RFC 5681 (3.1) IW, the initial value of cwnd, MUST be set using the
+	following guidelines as an upper bound.
+
+	If SMSS > 2190 bytes:
+		IW = 2 * SMSS bytes and MUST NOT be more than 2 segments
+	If (SMSS > 1095 bytes) and (SMSS <= 2190 bytes):
+		IW = 3 * SMSS bytes and MUST NOT be more than 3 segments
+	if SMSS <= 1095 bytes:
+		IW = 4 * SMSS bytes and MUST NOT be more than 4 segments
+
+	The initial value of ssthresh SHOULD be set arbitrarily high.
+*/
+void Congestion_control::init(uint32_t smss) {
+	smss_ = smss;
+	if(smss > 2190)
+		cwnd_ = 2 * smss;
+	else if(smss > 1095)
+		cwnd_ = 3 * smss;
+	else
+		cwnd_ = 4 * smss;
+	ssthresh_ = max_cwnd;
+}
+
+/*
+	RFC 5681 (3.1) During slow start, a TCP increments cwnd by at most SMSS
+	bytes for each ACK received that cumulatively acknowledges new data.
+*/
+void Congestion_control::on_ack(uint32_t acked, double srtt) {
+	if(slow_start())
+		cwnd_ += std::min(acked, smss_);
+	else
+		congestion_avoidance(acked, srtt);
+
+	if(cwnd_ > max_cwnd)
+		cwnd_ = max_cwnd;
+	debug2("<TCP::Congestion_control::on_ack> %s: acked %u => cwnd %u ssthresh %u \n",
+		name(), acked, cwnd_, ssthresh_);
+}
+
+/*
+	RFC 5681 (3.2) The lost segment starting at SND.UNA MUST be retransmitted
+	and cwnd set to ssthresh plus 3*SMSS. This artificially "inflates" the
+	congestion window by the number of segments (three) that have left the
+	network and which the receiver has buffered.
+*/
+void Congestion_control::on_fast_retransmit(uint32_t flight) {
+	ssthresh_ = loss_ssthresh(flight);
+	cwnd_ = ssthresh_ + 3 * smss_;
+	debug("<TCP::Congestion_control::on_fast_retransmit> %s: cwnd %u ssthresh %u \n",
+		name(), cwnd_, ssthresh_);
+}
+
+/*
+	RFC 5681 (3.2) For each additional duplicate ACK received (after the third),
+	cwnd MUST be incremented by SMSS.
+*/
+void Congestion_control::on_dup_ack() {
+	cwnd_ += smss_;
+}
+
+/*
+	RFC 6582 (3.2) Deflate the congestion window by the amount of new data
+	acknowledged by the cumulative acknowledgment field. If the partial ACK
+	acknowledges at least one SMSS of new data, then add back SMSS bytes
+	to the congestion window.
+*/
+void Congestion_control::on_partial_ack(uint32_t acked) {
+	cwnd_ -= std::min(acked, cwnd_);
+	if(acked >= smss_)
+		cwnd_ += smss_;
+	cwnd_ = std::max(cwnd_, smss_);
+}
+
+/*
+	RFC 6582 (3.2) Set cwnd to either (1) min (ssthresh, max(FlightSize, SMSS) + SMSS)
+	or (2) ssthresh. The first avoids a burst of data.
+*/
+void Congestion_control::on_recovery_exit(uint32_t flight) {
+	cwnd_ = std::min(ssthresh_, std::max(flight, smss_) + smss_);
+}
+
+/*
+	RFC 5681 (3.1) When a TCP sender detects segment loss using the
+	retransmission timer [...] cwnd MUST be set to no more than the loss
+	window, LW, which equals 1 full-sized segment.
+*/
+void Congestion_control::on_timeout(uint32_t flight) {
+	ssthresh_ = loss_ssthresh(flight);
+	cwnd_ = smss_;
+	debug("<TCP::Congestion_control::on_timeout> %s: cwnd %u ssthresh %u \n",
+		name(), cwnd_, ssthresh_);
+}
+
+/////////////////// NEWRENO ///////////////////
+
+std::shared_ptr<Congestion_control> TCP::NewReno::clone() const {
+	return std::make_shared<NewReno>();
+}
+
+void TCP::NewReno::init(uint32_t smss) {
+	Congestion_control::init(smss);
+	bytes_acked_ = 0;
+}
+
+/*
+	RFC 5681 (3.1) ssthresh = max (FlightSize / 2, 2*SMSS)
+*/
+uint32_t TCP::NewReno::loss_ssthresh(uint32_t flight) {
+	bytes_acked_ = 0;
+	return std::max(flight / 2, 2 * smss_);
+}
+
+/*
+	RFC 5681 (3.1) Set cwnd to cwnd + SMSS when the number of bytes
+	acknowledged reaches cwnd (appropriate byte counting).
+*/
+void TCP::NewReno::congestion_avoidance(uint32_t acked, double) {
+	bytes_acked_ += acked;
+	if(bytes_acked_ >= cwnd_) {
+		bytes_acked_ -= cwnd_;
+		cwnd_ += smss_;
+	}
+}
+
+/////////////////// CUBIC ///////////////////
+
+constexpr double TCP::Cubic::C;
+constexpr double TCP::Cubic::BETA;
+
+std::shared_ptr<Congestion_control> TCP::Cubic::clone() const {
+	return std::make_shared<Cubic>();
+}
+
+void TCP::Cubic::init(uint32_t smss) {
+	Congestion_control::init(smss);
+	w_max_ = 0;
+	k_ = 0;
+	origin_ = 0;
+	w_est_ = 0;
+	epoch_start_ = 0;
+	pending_ = 0;
+}
+
+/*
+	RFC 8312 (4.5) ssthresh = cwnd * beta_cubic, and with fast convergence (4.6),
+	W_max is reduced further when the window didn't get back to the last W_max
+	- another flow is probably taking its share.
+*/
+uint32_t TCP::Cubic::loss_ssthresh(uint32_t) {
+	double cwnd = (double) cwnd_ / smss_;
+	if(cwnd < w_max_)
+		w_max_ = cwnd * (1 + BETA) / 2;
+	else
+		w_max_ = cwnd;
+
+	epoch_start_ = 0;
+	return std::max<uint32_t>(cwnd_ * BETA, 2 * smss_);
+}
+
+/*
+	RFC 8312 (4.1) W_cubic(t) = C*(t-K)^3 + W_max, where K = cubic_root(W_max*(1-beta_cubic)/C)
+
+	The target is W_cubic one RTT ahead. Each ACK grows cwnd by
+	(target - cwnd) / cwnd segments, per segment acknowledged (4.3, 4.4).
+	When Reno would have a larger window (TCP-friendly region, 4.2), that's the target.
+*/
+void TCP::Cubic::congestion_avoidance(uint32_t acked, double srtt) {
+	const double cwnd = (double) cwnd_ / smss_;
+	const uint64_t now = OS::cycles_since_boot() / KHz(hw::PIT::CPUFrequency()).count();
+
+	if(epoch_start_ == 0) {
+		epoch_start_ = now ? now : 1;
+		w_est_ = cwnd;
+		pending_ = 0;
+		// Starting above W_max (no loss yet, or cwnd came back) - just probe
+		if(cwnd < w_max_) {
+			k_ = std::cbrt((w_max_ - cwnd) / C);
+			origin_ = w_max_;
+		}
+		else {
+			k_ = 0;
+			origin_ = cwnd;
+		}
+	}
+
+	const double segments = (double) acked / smss_;
+	const double t = (now - epoch_start_ + srtt) / 1000.0;
+	double target = origin_ + C * (t - k_) * (t - k_) * (t - k_);
+
+	// Reno's additive increase with the same average window (4.2)
+	w_est_ += 3 * (1 - BETA) / (1 + BETA) * segments / cwnd;
+	if(w_est_ > target)
+		target = w_est_;
+
+	// Don't more than grow by half per RTT, even far from W_max
+	target = std::min(target, cwnd * 1.5);
+
+	if(target > cwnd)
+		pending_ += smss_ * (target - cwnd) / cwnd * segments;
+	else
+		pending_ += smss_ * segments / (100 * cwnd);
+
+	if(pending_ >= 1) {
+		uint32_t grow = pending_;
+		cwnd_ += grow;
+		pending_ -= grow;
+	}
+}
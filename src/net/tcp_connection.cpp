@@ -19,12 +19,57 @@
 
 #include <net/tcp.hpp>
 #include <net/tcp_connection_states.hpp>
+#include <net/tcp_congestion.hpp>
+#include <os>
+#include <cmath>
 
 using namespace net;
 using Connection = TCP::Connection;
 
 using namespace std;
 
+/*
+	Sequence space taken up by a segment. SYN and FIN count as one octet each.
+*/
+static inline TCP::Seq seq_length(TCP::Packet& packet) {
+	return packet.data_length() + packet.isset(TCP::SYN) + packet.isset(TCP::FIN);
+}
+
+/*
+	a >= b, modulo 2^32
+*/
+static inline bool seq_geq(TCP::Seq a, TCP::Seq b) {
+	return (int32_t)(a - b) >= 0;
+}
+
+/*
+	Timestamp clock (RFC 7323 5.4), ticking in milliseconds.
+*/
+static inline uint32_t ts_clock() {
+	return (uint64_t) (OS::cycles_since_boot() / KHz(hw::PIT::CPUFrequency()).count());
+}
+
+/* Timestamps option value before it's stamped */
+static const uint32_t TS_ZERO[2] = { 0, 0 };
+
+/*
+	Smallest shift that gets the window into the 16 bit header field.
+*/
+static inline uint8_t window_shift(uint32_t wnd) {
+	uint8_t shift = 0;
+	while((wnd >> shift) > TCP::default_window_size and shift < TCP::max_window_shift)
+		shift++;
+	return shift;
+}
+
+/*
+	RFC 7323 (2.3) The window field is the window right-shifted by the shift count.
+*/
+static inline uint16_t window_field(uint32_t wnd, uint8_t shift) {
+	wnd >>= shift;
+	return (wnd < TCP::default_window_size) ? wnd : TCP::default_window_size;
+}
+
 /*
 	This is most likely used in a ACTIVE open
 */
@@ -37,8 +82,33 @@ Connection::Connection(TCP& host, Port local_port, Socket remote) :
 	control_block(),
 	receive_buffer_(host.buffer_limit()),
 	send_buffer_(host.buffer_limit()),
-	time_wait_started(0)
+	time_wait_timer_(hw::PIT::NO_TIMER),
+	rt_queue_(),
+	rtx_timer_(hw::PIT::NO_TIMER),
+	rtt_active_(false),
+	rtt_seq_(0),
+	rtt_start_(0),
+	retransmissions_(0),
+	send_queue_(),
+	congestion_(std::make_shared<TCP::NewReno>()),
+	dup_acks_(0),
+	fast_recovery_(false),
+	recover_(0),
+	fast_retransmits_(0),
+	ooo_queue_(),
+	ooo_last_(0),
+	sack_permitted_(false),
+	window_scaling_(false),
+	delack_timer_(hw::PIT::NO_TIMER),
+	delack_segments_(0),
+	delack_bytes_(0),
+	acks_coalesced_(0),
+	acks_piggybacked_(0),
+	rcv_edge_(0)
 {
+	// Set from the receive buffer with every segment sent
+	control_block.RCV.WND = 0;
+	congestion_->init(SMSS());
 
 }
 
@@ -54,8 +124,33 @@ Connection::Connection(TCP& host, Port local_port) :
 	control_block(),
 	receive_buffer_(host.buffer_limit()),
 	send_buffer_(host.buffer_limit()),
-	time_wait_started(0)
+	time_wait_timer_(hw::PIT::NO_TIMER),
+	rt_queue_(),
+	rtx_timer_(hw::PIT::NO_TIMER),
+	rtt_active_(false),
+	rtt_seq_(0),
+	rtt_start_(0),
+	retransmissions_(0),
+	send_queue_(),
+	congestion_(std::make_shared<TCP::NewReno>()),
+	dup_acks_(0),
+	fast_recovery_(false),
+	recover_(0),
+	fast_retransmits_(0),
+	ooo_queue_(),
+	ooo_last_(0),
+	sack_permitted_(false),
+	window_scaling_(false),
+	delack_timer_(hw::PIT::NO_TIMER),
+	delack_segments_(0),
+	delack_bytes_(0),
+	acks_coalesced_(0),
+	acks_piggybacked_(0),
+	rcv_edge_(0)
 {
+	// Set from the receive buffer with every segment sent
+	control_block.RCV.WND = 0;
+	congestion_->init(SMSS());
 	
 }
 
@@ -76,9 +171,56 @@ std::string Connection::read(size_t n) {
 		// Read all data.
 		n = receive_buffer_.data_size();
 	}
-	char buffer[n];
-	size_t length = read(&buffer[0], n);
-	return {buffer, length};
+	// Straight into the string, no copy in between
+	std::string data(n, '\0');
+	data.resize(read(&data[0], n));
+	return data;
+}
+
+Connection::Views Connection::read_views(size_t n) {
+	if(n == 0)
+		n = receive_buffer_.data_size();
+	Views views;
+	size_t bytes_read = 0;
+	while(!receive_buffer_.empty() and bytes_read < n) {
+		auto packet = receive_buffer_.front();
+		size_t offset = receive_buffer_.data_offset();
+		size_t consumed = offset;
+		// This packet's own payload, then each of the chained buffers
+		net::Packet_ptr piece = packet;
+		const uint8_t* data = (const uint8_t*) packet->data();
+		size_t piece_len = packet->buffer_data_length();
+		while(bytes_read < n) {
+			if(offset < piece_len) {
+				size_t len = std::min(piece_len - offset, n - bytes_read);
+				views.emplace_back(data + offset, len, piece);
+				bytes_read += len;
+				consumed += len;
+				offset += len;
+				if(offset < piece_len)
+					break;
+			}
+			offset -= piece_len;
+			piece = piece->unchain();
+			if(!piece)
+				break;
+			data = piece->buffer();
+			piece_len = piece->size();
+		}
+		// Read the whole packet
+		if(consumed == packet->data_length()) {
+			receive_buffer_.pop();
+			receive_buffer_.set_data_offset(0);
+		}
+		// Stopped inside it; remember where
+		else {
+			receive_buffer_.set_data_offset(consumed);
+			break;
+		}
+	}
+	debug2("<TCP::Connection::read_views> %u bytes in %u views \n", bytes_read, views.size());
+	receive_window_opened();
+	return views;
 }
 
 size_t Connection::read_from_receive_buffer(char* buffer, size_t n) {
@@ -89,17 +231,17 @@ size_t Connection::read_from_receive_buffer(char* buffer, size_t n) {
 		// Packet in front
 		auto packet = receive_buffer_.front();
 		// Where to begin reading
-		char* begin = packet->data()+receive_buffer_.data_offset();
-		// Read this iteration
-		size_t total{0};
+		size_t offset = receive_buffer_.data_offset();
+		// Remaining bytes in this packet (including any chained buffers)
+		size_t available = packet->data_length() - offset;
 		// Remaining bytes to read.
 		size_t remaining = n - bytes_read;
-		// Trying to read over more than one packet
-		if( remaining >= (packet->data_length() - receive_buffer_.data_offset()) ) {
-			debug2("<TCP::Connection_read_from_receive_buffer> Remaining >: %u Current p: %u\n", 
-				remaining, packet->data_length() - receive_buffer_.data_offset());
-			// Reading whole packet
-			total = packet->data_length();
+		// Read this iteration
+		size_t total = packet->copy_data(buffer+bytes_read, offset, std::min(remaining, available));
+		bytes_read += total;
+		// Read the whole packet
+		if(total == available) {
+			debug2("<TCP::Connection_read_from_receive_buffer> Done with packet: %u bytes\n", packet->data_length());
 			// Removing packet from receive buffer.
 			receive_buffer_.pop();
 			// Next packet will start from beginning.
@@ -108,13 +250,11 @@ size_t Connection::read_from_receive_buffer(char* buffer, size_t n) {
 		// Reading less than one packet.
 		else {
 			debug2("<TCP::Connection_read_from_receive_buffer> Remaining <: %u\n", remaining);
-			total = remaining;
-			receive_buffer_.set_data_offset(packet->data_length() - remaining);
+			receive_buffer_.set_data_offset(offset + total);
 		}
-		memcpy(buffer+bytes_read, begin, total);
-		bytes_read += total;
 	}
 
+	receive_window_opened();
 	return bytes_read;
 }
 
@@ -122,6 +262,16 @@ bool Connection::add_to_receive_buffer(TCP::Packet_ptr packet) {
 	return receive_buffer_.add(packet);
 }
 
+size_t Connection::write(const Slices& slices, bool PUSH) {
+	debug("<TCP::Connection::write> Asking to write %u slices to SND buffer. \n", slices.size());
+	try {
+		return state_->send(*this, slices, PUSH);
+	} catch(TCPException err) {
+		signal_error(err);
+		return 0;
+	}
+}
+
 size_t Connection::write(const char* buffer, size_t n, bool PUSH) {
 	debug("<TCP::Connection::write> Asking to write %u bytes of data to SND buffer. \n", n);
 	try {
@@ -137,9 +287,18 @@ size_t Connection::write_to_send_buffer(const char* buffer, size_t n, bool PUSH)
 	size_t remaining{n};
 	do {
 		auto packet = create_outgoing_packet();
-		size_t written = packet->set_seq(control_block.SND.NXT).set_ack(control_block.RCV.NXT).set_flag(ACK).fill(buffer + (n-remaining), remaining);
-		bytes_written += written;
+		size_t written = packet->set_seq(control_block.SND.NXT).set_ack(control_block.RCV.NXT).set_flag(ACK)
+			.fill(buffer + (n-remaining), std::min<size_t>(remaining, SMSS()));
 		remaining -= written;
+
+		// If the NIC can segment, let it. Keep filling this one packet.
+		if(remaining and host_.inet_.tso()) {
+			size_t appended = append_tso_payload(packet, buffer + (n-remaining), remaining);
+			written += appended;
+			remaining -= appended;
+		}
+
+		bytes_written += written;
 		
 		debug("<TCP::Connection::write_to_send_buffer> Written: %u - Remaining: %u \n", written, remaining);
 		
@@ -149,11 +308,103 @@ size_t Connection::write_to_send_buffer(const char* buffer, size_t n, bool PUSH)
 
 		// Advance outgoing sequence number (SND.NXT) with the length of the data.
 		control_block.SND.NXT += packet->data_length();
-	} while(remaining and !send_buffer_.full());
+	} while(remaining and (send_buffer_.size() + send_queue_.size()) < send_buffer_.limit());
+
+	return bytes_written;
+}
+
+size_t Connection::write_to_send_buffer(const Slices& slices, bool PUSH) {
+	const uint16_t mss = SMSS();
+	size_t bytes_written{0};
+	auto slice = slices.begin();
+	size_t slice_offset{0};
+
+	auto skip_empty = [&] {
+		while(slice != slices.end() and slice_offset == slice->length) {
+			++slice;
+			slice_offset = 0;
+		}
+	};
+	skip_empty();
+
+	while(slice != slices.end() and (send_buffer_.size() + send_queue_.size()) < send_buffer_.limit()) {
+		auto packet = create_outgoing_packet();
+		packet->set_seq(control_block.SND.NXT).set_ack(control_block.RCV.NXT).set_flag(ACK);
+
+		// If the NIC can segment, let it. As much as the IP datagram and the windows allow.
+		size_t max = mss;
+		if(host_.inet_.tso()) {
+			const uint32_t wnd = std::min<uint32_t>(control_block.SND.WND, congestion_->cwnd());
+			max = std::max<size_t>(mss, std::min<size_t>(wnd,
+				TCP::tso_max_size - (packet->size() - sizeof(LinkLayer::header))));
+		}
+
+		size_t length{0};
+		net::Packet_ptr tail = packet;
+		for(size_t chained = 0; slice != slices.end() and length < max
+			and chained < TCP::max_chained_buffers; chained++)
+		{
+			size_t len = std::min(slice->length - slice_offset, max - length);
+			auto* data = (net::BufferStore::buffer_t) slice->data + slice_offset;
+			// The buffer is the user's; only let go of the owner when done
+			auto piece = net::Packet::create(data, len, len,
+				net::Packet::release_del::from<net::no_release>());
+			piece->set_owner(slice->owner);
+			tail->chain(piece);
+			tail = piece;
+			length += len;
+			slice_offset += len;
+			skip_empty();
+		}
+
+		if(length > mss)
+			packet->set_gso(mss, packet->all_headers_len());
+		bytes_written += length;
+
+		debug("<TCP::Connection::write_to_send_buffer> Chained: %u bytes in %u buffers \n",
+			length, packet->chain_length() - 1);
+
+		// If last packet, add PUSH.
+		if(slice == slices.end() and PUSH)
+			packet->set_flag(PSH);
+
+		control_block.SND.NXT += packet->data_length();
+	}
 
 	return bytes_written;
 }
 
+size_t Connection::append_tso_payload(TCP::Packet_ptr packet, const char* buffer, size_t n) {
+	// The first packet is a full segment. That's what the NIC will cut into.
+	const uint16_t mss = packet->buffer_data_length();
+	// Stay within the largest IP datagram, and the receiver's and congestion window.
+	size_t max = TCP::tso_max_size - (packet->size() - sizeof(LinkLayer::header));
+	const uint32_t wnd = std::min<uint32_t>(control_block.SND.WND, congestion_->cwnd());
+	if(wnd > mss)
+		max = std::min<size_t>(max, wnd - mss);
+	else
+		max = 0;
+
+	size_t total{0};
+	net::Packet_ptr tail = packet;
+	while(total < n and total < max) {
+		auto frag = host_.inet_.createPacket(0);
+		size_t len = std::min<size_t>(std::min(n, max) - total, frag->capacity());
+		memcpy(frag->buffer(), buffer + total, len);
+		frag->set_size(len);
+		tail->chain(frag);
+		tail = frag;
+		total += len;
+	}
+
+	if(total) {
+		packet->set_gso(mss, packet->all_headers_len());
+		debug2("<TCP::Connection::append_tso_payload> %u bytes in %u chained buffers, MSS %u \n", 
+			total, packet->chain_length() - 1, mss);
+	}
+	return total;
+}
+
 /*
 	If ACTIVE: 
 	Need a remote Socket.
@@ -194,7 +445,7 @@ void Connection::receive(TCP::Packet_ptr incoming) {
 	// Let state handle what to do when incoming packet arrives, and modify the outgoing packet.
 	signal_packet_received(incoming);
 	// Change window accordingly. 
-	control_block.SND.WND = incoming->win();
+	control_block.SND.WND = segment_window(*incoming);
 	switch(state_->handle(*this, incoming)) {
 		case State::OK: {
 			// Do nothing.
@@ -226,13 +477,17 @@ bool Connection::is_closing() const {
 }
 
 bool Connection::is_writable() const {
-	return (is_connected() and (!send_buffer_.full()));
+	return (is_connected() and (send_buffer_.size() + send_queue_.size()) < send_buffer_.limit());
 }
 
 Connection::~Connection() {
 	// Do all necessary clean up.
 	// Free up buffers etc.
 	debug2("<TCP::Connection::~Connection> Bye bye... \n");
+	// The timers hold on to this
+	hw::PIT::instance().stop_timer(time_wait_timer_);
+	rtx_stop();
+	delack_stop();
 }
 
 
@@ -245,7 +500,12 @@ TCP::Packet_ptr Connection::create_outgoing_packet() {
 	// Set Destination (remote)
 	packet->set_destination(remote_);
 
-	packet->set_win_size(control_block.SND.WND);
+	update_receive_window();
+	packet->set_win_size(window_field(control_block.RCV.WND, control_block.RCV.WS));
+
+	// Room for timestamps, on every segment once negotiated
+	if(control_block.TS.OK)
+		packet->add_option(TCP::OPT_TS, 10, TS_ZERO);
 	
 	// Set SEQ and ACK - I think this is OK..
 	packet->set_seq(control_block.SND.NXT).set_ack(control_block.RCV.NXT);
@@ -264,17 +524,53 @@ void Connection::transmit() {
 	while(! send_buffer_.empty() ) {
 		auto packet = send_buffer_.front();
 		assert(! packet->destination().is_empty());
-		transmit(packet);
+		// Keep the order of what takes up sequence space
+		if(packet->has_data() and (!send_queue_.empty() or !can_send(*packet)))
+			send_queue_.push_back(packet);
+		else if((packet->isset(SYN) or packet->isset(FIN)) and !send_queue_.empty())
+			send_queue_.push_back(packet);
+		else
+			transmit(packet);
 		send_buffer_.pop();
 	}
 }
 
+void Connection::transmit_queued() {
+	while(!send_queue_.empty() and can_send(*send_queue_.front())) {
+		auto packet = send_queue_.front();
+		send_queue_.pop_front();
+		// It has been waiting; acknowledge what's arrived since
+		packet->set_ack(control_block.RCV.NXT);
+		transmit(packet);
+	}
+	debug2("<TCP::Connection::transmit_queued> %u segments queued, flight %u cwnd %u \n",
+		send_queue_.size(), flight_size(), congestion_->cwnd());
+}
+
+/*
+	RFC 5681 (3.1) The TCP sender MUST NOT send data with a sequence number
+	higher than the sum of the highest acknowledged sequence number and
+	the minimum of cwnd and rwnd.
+
+	One segment is always let out when nothing is in flight, or a segment
+	larger than the window (TSO) would never go.
+*/
+bool Connection::can_send(TCP::Packet& packet) const {
+	if(rt_queue_.empty())
+		return true;
+	const uint32_t wnd = std::min<uint32_t>(congestion_->cwnd(), control_block.SND.WND);
+	return flight_size() + packet.data_length() <= wnd;
+}
+
 void Connection::transmit(TCP::Packet_ptr packet) {
 	debug("<TCP::Connection::transmit> Transmitting: %s \n", packet->to_string().c_str());
+	add_options(*packet);
+	stamp(*packet);
+	delack_sent(*packet);
 	host_.transmit(packet);
-	// Don't think we would like to retransmit reset packets..?
-	//if(!packet->isset(RST))
-	//	add_retransmission(packet);
+	// Only what takes up sequence space is ever acknowledged
+	if(packet->has_data() or packet->isset(SYN) or packet->isset(FIN))
+		add_retransmission(packet);
 }
 
 TCP::Packet_ptr Connection::outgoing_packet() {
@@ -294,50 +590,578 @@ void Connection::set_state(State& state) {
 			prev_state_->to_string().c_str(), state_->to_string().c_str());
 }
 
+/*
+	RFC 6298 (2.5) Upper bound for RTO, at least 60 seconds.
+*/
+static const uint32_t MAX_RTO_MS = 60000;
+
 void Connection::add_retransmission(TCP::Packet_ptr packet) {
 	debug2("<TCP::Connection::add_retransmission> Packet added to retransmission. \n");
-	auto self = shared_from_this();
-	hw::PIT::instance().onTimeout(RTO(), [packet, self] {
-		// Packet hasnt been ACKed.
-		if(packet->seq() > self->tcb().SND.UNA) {
-			debug("<TCP::Connection::add_retransmission@onTimeout> Packet unacknowledge, retransmitting...\n");
-			self->transmit(packet);
-		} else {
-			debug2("<TCP::Connection::add_retransmission@onTimeout> Packet acknowledged %s \n", packet->to_string().c_str());
-			// Signal user?
+	rt_queue_.push_back({packet, false});
+	rtx_start();
+
+	// Time one segment per round trip, unless every ACK echoes a timestamp
+	if(!rtt_active_ and !control_block.TS.OK) {
+		rtt_active_ = true;
+		rtt_seq_ = packet->seq() + seq_length(*packet);
+		rtt_start_ = OS::cycles_since_boot();
+	}
+}
+
+void Connection::rt_acknowledge(TCP::Packet& in, uint32_t acked) {
+	const TCP::Seq ack = control_block.SND.UNA;
+	uint32_t ts_val, ts_ecr;
+	/*
+		RFC 7323 (4.1) An ACK of new data echoes when what it acknowledges was
+		sent - retransmissions included, as those have a fresh TSval.
+	*/
+	if(control_block.TS.OK and in.timestamps(ts_val, ts_ecr) and ts_ecr
+		and (int32_t)(ts_clock() - ts_ecr) >= 0)
+	{
+		rtt_measure(ts_clock() - ts_ecr);
+	}
+	else if(rtt_active_ and seq_geq(ack, rtt_seq_)) {
+		rtt_active_ = false;
+		auto cycles = OS::cycles_since_boot() - rtt_start_;
+		rtt_measure(cycles / KHz(hw::PIT::CPUFrequency()).count());
+	}
+
+	while(!rt_queue_.empty()) {
+		auto& packet = *rt_queue_.front().packet;
+		if(!seq_geq(ack, packet.seq() + seq_length(packet)))
+			break;
+		rt_queue_.pop_front();
+	}
+
+	dup_acks_ = 0;
+	if(fast_recovery_) {
+		// RFC 6582 (3.2) Full acknowledgment; everything sent before the loss
+		if(seq_geq(ack, recover_)) {
+			fast_recovery_ = false;
+			congestion_->on_recovery_exit(flight_size());
 		}
-	});
+		// Partial acknowledgment; the next segment is lost too
+		else {
+			congestion_->on_partial_ack(acked);
+			retransmit();
+		}
+	}
+	else {
+		congestion_->on_ack(acked, control_block.RTT.SRTT);
+	}
+
+	/*
+		RFC 6298 (5.2) When all outstanding data has been acknowledged, turn off the
+		retransmission timer. (5.3) When an ACK is received that acknowledges new data,
+		restart the retransmission timer so that it will expire after RTO seconds.
+	*/
+	if(rt_queue_.empty())
+		rtx_stop();
+	else
+		rtx_restart();
+}
+
+/*
+	RFC 6582 (3.2) When the third duplicate ACK is received, the TCP sender first
+	checks the value of recover to see if the Cumulative Acknowledgment field covers
+	more than recover. If so, the value of recover is incremented to the value of
+	the highest sequence number transmitted by the TCP so far. The TCP then enters
+	fast retransmit. If not, the TCP does not enter fast retransmit.
+*/
+void Connection::dup_acknowledge() {
+	dup_acks_++;
+	if(fast_recovery_) {
+		congestion_->on_dup_ack();
+		transmit_queued();
+	}
+	else if(dup_acks_ == 3 and seq_geq(control_block.SND.UNA - 1, recover_)) {
+		fast_recovery_ = true;
+		recover_ = control_block.SND.UNA + flight_size();
+		congestion_->on_fast_retransmit(flight_size());
+		fast_retransmits_++;
+		debug("<TCP::Connection::dup_acknowledge> Three duplicate ACKs, fast retransmit. \n");
+		retransmit();
+		rtx_restart();
+	}
+}
+
+void Connection::retransmit() {
+	if(rt_queue_.empty())
+		return;
+	// The first hole; SACKed segments have arrived
+	auto it = rt_queue_.begin();
+	while(it != rt_queue_.end() and it->sacked)
+		++it;
+	auto packet = (it != rt_queue_.end() ? it : rt_queue_.begin())->packet;
+	debug("<TCP::Connection::retransmit> Retransmitting %s \n", packet->to_string().c_str());
+	// Karn: An ACK now can't tell which transmission it's for
+	rtt_active_ = false;
+	if(packet->isset(ACK))
+		packet->set_ack(control_block.RCV.NXT);
+	stamp(*packet);
+	delack_sent(*packet);
+	host_.transmit(packet);
+}
+
+void Connection::rtx_timeout() {
+	rtx_timer_ = hw::PIT::NO_TIMER;
+	if(rt_queue_.empty())
+		return;
+
+	// RFC 6298 (5.5) Back off the timer, (5.4) and retransmit the earliest segment
+	control_block.RTT.RTO = std::min(control_block.RTT.RTO * 2, MAX_RTO_MS);
+	retransmissions_++;
+	debug("<TCP::Connection::rtx_timeout> Packet unacknowledged (RTO %u ms) \n", control_block.RTT.RTO);
+
+	// RFC 5681 (3.1) Back to slow start. RFC 6582 (4) Don't fast retransmit what was sent before.
+	congestion_->on_timeout(flight_size());
+	fast_recovery_ = false;
+	dup_acks_ = 0;
+	recover_ = control_block.SND.UNA + flight_size();
+	/*
+		RFC 2018 (8) After a retransmit timeout the data sender SHOULD turn off
+		all of the SACKed bits, since the timeout might indicate that the
+		data receiver has reneged.
+	*/
+	for(auto& entry : rt_queue_)
+		entry.sacked = false;
+	retransmit();
+
+	rtx_start();
+}
+
+void Connection::delack_add(uint32_t length) {
+	delack_segments_++;
+	delack_bytes_ += length;
+}
+
+/*
+	RFC 1122 (4.2.3.2) A TCP SHOULD implement a delayed ACK, but an ACK should not
+	be excessively delayed; in particular, the delay MUST be less than 0.5 seconds,
+	and in a stream of full-sized segments there SHOULD be an ACK for at least
+	every second segment.
+*/
+void Connection::delack_check(bool immediate) {
+	// Already went out with what the user wrote
+	if(!delack_segments_)
+		return;
+	/*
+		RFC 1122 4.2.3.2 ACK at least every second full-sized segment. The peer's
+		full segments are the same size as ours - the smaller of the two MSS,
+		less the options on every segment (timestamps).
+	*/
+	if(immediate or delack_bytes_ >= 2u * SMSS() or host_.delayed_ack().count() == 0) {
+		outgoing_packet()->set_seq(control_block.SND.NXT).set_ack(control_block.RCV.NXT).set_flag(ACK);
+		transmit();
+		return;
+	}
+	if(delack_timer_ == hw::PIT::NO_TIMER) {
+		// Passing "this" is fine; the timer is stopped when we're gone
+		delack_timer_ = hw::PIT::instance().onTimeout(host_.delayed_ack(),
+			hw::PIT::timeout_handler::from<Connection, &Connection::delack_timeout>(this));
+	}
+}
+
+void Connection::delack_sent(TCP::Packet& packet) {
+	if(!delack_segments_ or !packet.isset(ACK) or packet.ack() != control_block.RCV.NXT)
+		return;
+	if(packet.has_data() or packet.isset(SYN) or packet.isset(FIN))
+		acks_piggybacked_ += delack_segments_;
+	else
+		acks_coalesced_ += delack_segments_ - 1;
+	delack_segments_ = 0;
+	delack_bytes_ = 0;
+	delack_stop();
+}
+
+void Connection::delack_timeout() {
+	delack_timer_ = hw::PIT::NO_TIMER;
+	debug2("<TCP::Connection::delack_timeout> %u segments to acknowledge \n", delack_segments_);
+	delack_check(true);
+}
+
+void Connection::delack_stop() {
+	hw::PIT::instance().stop_timer(delack_timer_);
+	delack_timer_ = hw::PIT::NO_TIMER;
+}
+
+uint32_t Connection::flight_size() const {
+	if(rt_queue_.empty())
+		return 0;
+	auto& last = *rt_queue_.back().packet;
+	return last.seq() + seq_length(last) - control_block.SND.UNA;
+}
+
+uint16_t Connection::SMSS() const {
+	const uint16_t peer = control_block.SND.MSS;
+	uint16_t mss = std::min(host_.MSS(), peer);
+	// RFC 6691 The MSS doesn't count options. Timestamps take 12 octets, padded.
+	if(control_block.TS.OK)
+		mss -= 12;
+	return mss;
+}
+
+Connection& Connection::set_congestion_control(std::shared_ptr<Congestion_control> cc) {
+	congestion_ = cc;
+	congestion_->init(SMSS());
+	return *this;
+}
+
+void Connection::rtx_start() {
+	if(rtx_timer_ != hw::PIT::NO_TIMER)
+		return;
+	// Passing "this" is fine; the timer is stopped when we're gone
+	rtx_timer_ = hw::PIT::instance().onTimeout(RTO(),
+		hw::PIT::timeout_handler::from<Connection, &Connection::rtx_timeout>(this));
 }
+
+void Connection::rtx_restart() {
+	rtx_stop();
+	rtx_start();
+}
+
+void Connection::rtx_stop() {
+	hw::PIT::instance().stop_timer(rtx_timer_);
+	rtx_timer_ = hw::PIT::NO_TIMER;
+}
+
 /*
-	Next compute a Smoothed Round Trip Time (SRTT) as:
+	RFC 6298 (2.2) When the first RTT measurement R is made, the host MUST set
 
-    SRTT = ( ALPHA * SRTT ) + ((1-ALPHA) * RTT)
+		SRTT <- R
+		RTTVAR <- R/2
+		RTO <- SRTT + max (G, K*RTTVAR)
 
-	and based on this, compute the retransmission timeout (RTO) as:
+	(2.3) When a subsequent RTT measurement R' is made, a host MUST set
 
-	RTO = min[UBOUND,max[LBOUND,(BETA*SRTT)]]
+		RTTVAR <- (1 - beta) * RTTVAR + beta * |SRTT - R'|
+		SRTT <- (1 - alpha) * SRTT + alpha * R'
 
-	where UBOUND is an upper bound on the timeout (e.g., 1 minute),
-	LBOUND is a lower bound on the timeout (e.g., 1 second), ALPHA is
-	a smoothing factor (e.g., .8 to .9), and BETA is a delay variance
-	factor (e.g., 1.3 to 2.0).
+	where K = 4, alpha = 1/8 and beta = 1/4. G is the clock granularity.
+	(2.4) Whenever RTO is computed, if it is less than 1 second, then the
+	RTO SHOULD be rounded up to 1 second - here, up to TCP::min_RTO().
+	(2.5) A maximum value MAY be placed on RTO provided it is at least 60 seconds.
 */
+void Connection::rtt_measure(double R) {
+	// Not by reference; the control block is packed
+	auto RTT = control_block.RTT;
+	if(RTT.SRTT == 0) {
+		RTT.SRTT = R;
+		RTT.RTTVAR = R / 2;
+	}
+	else {
+		RTT.RTTVAR = 0.75 * RTT.RTTVAR + 0.25 * std::abs(RTT.SRTT - R);
+		RTT.SRTT = 0.875 * RTT.SRTT + 0.125 * R;
+	}
+	// PIT granularity is 1 ms
+	double rto = RTT.SRTT + std::max(1.0, 4 * RTT.RTTVAR);
+	rto = std::max(rto, (double) host_.min_RTO().count());
+	RTT.RTO = std::min<double>(rto, MAX_RTO_MS);
+	control_block.RTT = RTT;
+	debug2("<TCP::Connection::rtt_measure> RTT %f ms => SRTT %f RTTVAR %f RTO %u \n",
+		R, RTT.SRTT, RTT.RTTVAR, RTT.RTO);
+}
+
 std::chrono::milliseconds Connection::RTO() const {
-	return 1s;
+	return std::chrono::milliseconds(control_block.RTT.RTO);
+}
+
+void Connection::add_options(TCP::Packet& packet) {
+	if(packet.has_data())
+		return;
+
+	if(packet.isset(SYN)) {
+		// Options are sent once; retransmissions have them already
+		if(packet.find_option(TCP::OPT_MSS))
+			return;
+		// On SYN,ACK only what the other end offered
+		const bool syn_ack = packet.isset(ACK);
+
+		// RFC 7323 (2.2) The window in a SYN is never scaled
+		packet.set_win_size(window_field(control_block.RCV.WND, 0));
+
+		const uint16_t mss = htons(host_.MSS());
+		packet.add_option(TCP::OPT_MSS, 4, &mss);
+
+		if(!syn_ack or window_scaling_) {
+			const uint8_t shift = window_shift(max_receive_window());
+			packet.add_option(TCP::OPT_WS, 3, &shift);
+		}
+
+		if(host_.sack() and (!syn_ack or sack_permitted_))
+			packet.add_option(TCP::OPT_SACK_PERM);
+
+		if(host_.timestamps() and !packet.find_option(TCP::OPT_TS)
+			and (!syn_ack or control_block.TS.OK))
+		{
+			packet.add_option(TCP::OPT_TS, 10, TS_ZERO);
+		}
+		return;
+	}
+
+	if(!sack_permitted_ or ooo_queue_.empty() or !packet.isset(ACK)
+		or packet.find_option(TCP::OPT_SACK))
+		return;
+
+	/*
+		RFC 2018 (4) The first SACK block MUST specify the contiguous block of data
+		containing the segment which triggered this ACK. The rest should repeat the
+		most recently reported blocks - here, the ones closest to RCV.NXT.
+	*/
+	const size_t max_blocks = (TCP::max_header_size - packet.header_size() - 4) / 8;
+	uint32_t blocks[2 * 4];
+	size_t count = 0;
+	size_t first = 0;
+
+	for(auto it = ooo_queue_.begin(); it != ooo_queue_.end(); ) {
+		const TCP::Seq left = (*it)->seq();
+		TCP::Seq right = left;
+		bool latest = false;
+		// Contiguous segments make one block
+		for(; it != ooo_queue_.end() and (*it)->seq() == right; ++it) {
+			latest |= (*it)->seq() == ooo_last_;
+			right += (*it)->data_length();
+		}
+		if(count < max_blocks) {
+			if(latest)
+				first = count;
+			count++;
+		}
+		else if(latest) {
+			// No room for it, but it has to be there
+			first = count - 1;
+		}
+		else
+			continue;
+		blocks[2 * (count - 1)] = htonl(left);
+		blocks[2 * (count - 1) + 1] = htonl(right);
+	}
+
+	if(first) {
+		std::swap(blocks[0], blocks[2 * first]);
+		std::swap(blocks[1], blocks[2 * first + 1]);
+	}
+	packet.add_option(TCP::OPT_SACK, 2 + 8 * count, blocks);
+}
+
+void Connection::parse_syn_options(TCP::Packet& packet) {
+	// RCV.NXT is set from the SYN; no window is advertised in its sequence space yet
+	rcv_edge_ = control_block.RCV.NXT;
+	sack_permitted_ = host_.sack() and packet.find_option(TCP::OPT_SACK_PERM);
+
+	auto* mss = packet.find_option(TCP::OPT_MSS);
+	if(mss and mss[1] == 4)
+		control_block.SND.MSS = (mss[2] << 8) | mss[3];
+
+	/*
+		RFC 7323 (2.2) Window scaling is on when both ends sent Window Scale.
+		(2.3) A shift count larger than 14 is taken as 14.
+	*/
+	auto* ws = packet.find_option(TCP::OPT_WS);
+	window_scaling_ = ws and ws[1] == 3;
+	if(window_scaling_) {
+		control_block.SND.WS = (ws[2] < TCP::max_window_shift) ? ws[2] : TCP::max_window_shift;
+		control_block.RCV.WS = window_shift(max_receive_window());
+	}
+
+	// RFC 7323 (3.2) Timestamps are on when both ends sent them in the SYN
+	uint32_t ts_val, ts_ecr;
+	control_block.TS.OK = host_.timestamps() and packet.timestamps(ts_val, ts_ecr);
+	if(control_block.TS.OK)
+		control_block.TS.RECENT = ts_val;
+
+	// Segments are another size than assumed
+	congestion_->init(SMSS());
+	debug("<TCP::Connection::parse_syn_options> MSS %u WS %u/%u SACK %i TS %i \n",
+		SMSS(), control_block.SND.WS, control_block.RCV.WS, sack_permitted_, control_block.TS.OK);
+}
+
+void Connection::stamp(TCP::Packet& packet) {
+	if(packet.isset(ACK))
+		control_block.TS.LAST_ACK_SENT = packet.ack();
+	if(packet.find_option(TCP::OPT_TS))
+		packet.set_timestamps(ts_clock(), packet.isset(ACK) ? control_block.TS.RECENT : 0);
+}
+
+/*
+	RFC 7323 (5.3) R1) If there is a Timestamps option in the arriving segment,
+	SEG.TSval < TS.Recent, and if TS.Recent is valid, then treat the arriving
+	segment as not acceptable. (Not for RST segments.)
+*/
+bool Connection::paws_reject(TCP::Packet& packet) const {
+	uint32_t ts_val, ts_ecr;
+	if(!control_block.TS.OK or packet.isset(RST) or !packet.timestamps(ts_val, ts_ecr))
+		return false;
+	return (int32_t)(ts_val - control_block.TS.RECENT) < 0;
+}
+
+/*
+	RFC 7323 (4.3) If SEG.TSval >= TS.Recent and SEG.SEQ <= Last.ACK.sent,
+	then SEG.TSval is copied to TS.Recent.
+*/
+void Connection::update_ts_recent(TCP::Packet& packet) {
+	uint32_t ts_val, ts_ecr;
+	if(!control_block.TS.OK or !packet.timestamps(ts_val, ts_ecr))
+		return;
+	if((int32_t)(ts_val - control_block.TS.RECENT) >= 0
+		and seq_geq(control_block.TS.LAST_ACK_SENT, packet.seq()))
+		control_block.TS.RECENT = ts_val;
+}
+
+uint32_t Connection::segment_window(TCP::Packet& packet) const {
+	if(packet.isset(SYN))
+		return packet.win();
+	return (uint32_t) packet.win() << control_block.SND.WS;
+}
+
+/*
+	The receive buffer holds a number of segments, not octets. Every free slot
+	counts as a full-sized segment; out-of-order segments take their slot ahead.
+*/
+uint32_t Connection::receive_room() const {
+	const size_t held = receive_buffer_.size() + ooo_queue_.size();
+	const size_t slots = (held < receive_buffer_.limit()) ? receive_buffer_.limit() - held : 0;
+	const uint64_t room = (uint64_t) slots * host_.MSS();
+	return (room < host_.window_size()) ? room : host_.window_size();
+}
+
+uint32_t Connection::max_receive_window() const {
+	const uint64_t room = (uint64_t) receive_buffer_.limit() * host_.MSS();
+	return (room < host_.window_size()) ? room : host_.window_size();
+}
+
+/*
+	RFC 793 (3.7) The window offered is the room in the receive buffer.
+	It's strongly discouraged to shrink the window (move its right edge left),
+	and RFC 7323 (2.4) says the receiver must not - only data received into it
+	closes it.
+*/
+void Connection::update_receive_window() {
+	uint32_t wnd = receive_room();
+	// What was advertised before still holds
+	const uint32_t advertised = rcv_edge_ - control_block.RCV.NXT;
+	if(advertised > wnd and advertised <= control_block.RCV.WND)
+		wnd = advertised;
+	control_block.RCV.WND = wnd;
+	rcv_edge_ = control_block.RCV.NXT + wnd;
+}
+
+/*
+	RFC 1122 (4.2.3.3) Receiver SWS avoidance: Only tell the other end about a
+	larger window when it makes room for a full segment. If the window it
+	knows is smaller than that, it's waiting for this.
+*/
+void Connection::receive_window_opened() {
+	if(!is_connected())
+		return;
+	const uint32_t advertised = rcv_edge_ - control_block.RCV.NXT;
+	if(advertised >= host_.MSS() or receive_room() < host_.MSS())
+		return;
+	debug2("<TCP::Connection::receive_window_opened> %u octets now, %u advertised \n",
+		receive_room(), advertised);
+	outgoing_packet()->set_seq(control_block.SND.NXT).set_ack(control_block.RCV.NXT).set_flag(ACK);
+	transmit();
+}
+
+bool Connection::ooo_insert(TCP::Packet_ptr packet) {
+	const TCP::Seq nxt = control_block.RCV.NXT;
+	// Offsets from RCV.NXT compare without wrapping
+	uint32_t start = packet->seq() - nxt;
+	uint32_t end = start + packet->data_length();
+
+	auto it = ooo_queue_.begin();
+	while(it != ooo_queue_.end() and (*it)->seq() - nxt < start)
+		++it;
+
+	// Overlaps the one before; keep only the new part
+	if(it != ooo_queue_.begin()) {
+		auto& prev = *std::prev(it);
+		uint32_t prev_end = prev->seq() - nxt + prev->data_length();
+		if(prev_end >= end)
+			return true;
+		if(prev_end > start) {
+			packet->trim_front(prev_end - start);
+			start = prev_end;
+		}
+	}
+
+	// Replaces the ones it covers, and overlaps the one after
+	while(it != ooo_queue_.end()) {
+		uint32_t s = (*it)->seq() - nxt;
+		if(s >= end)
+			break;
+		if(s + (*it)->data_length() <= end) {
+			it = ooo_queue_.erase(it);
+			continue;
+		}
+		(*it)->trim_front(end - s);
+		break;
+	}
+
+	if(ooo_queue_.size() >= receive_buffer_.limit())
+		return false;
+
+	ooo_queue_.insert(it, packet);
+	ooo_last_ = packet->seq();
+	debug2("<TCP::Connection::ooo_insert> Holding SEQ %u, %u segments out of order \n",
+		packet->seq(), ooo_queue_.size());
+	return true;
+}
+
+bool Connection::ooo_deliver() {
+	bool push = false;
+	while(!ooo_queue_.empty()) {
+		auto packet = ooo_queue_.front();
+		const TCP::Seq nxt = control_block.RCV.NXT;
+		// Still a gap
+		if(!seq_geq(nxt, packet->seq()))
+			break;
+		uint32_t received = nxt - packet->seq();
+		if(received >= packet->data_length()) {
+			ooo_queue_.pop_front();
+			continue;
+		}
+		if(received)
+			packet->trim_front(received);
+		if(!add_to_receive_buffer(packet))
+			break;
+		ooo_queue_.pop_front();
+		control_block.RCV.NXT += packet->data_length();
+		push |= packet->isset(PSH);
+	}
+	return push;
+}
+
+void Connection::sack_acknowledge(TCP::Packet& packet) {
+	if(!sack_permitted_ or rt_queue_.empty())
+		return;
+	auto* opt = packet.find_option(TCP::OPT_SACK);
+	if(!opt)
+		return;
+
+	const size_t count = (opt[1] - 2) / 8;
+	for(size_t i = 0; i < count; i++) {
+		uint32_t edges[2];
+		memcpy(edges, opt + 2 + 8 * i, sizeof(edges));
+		const TCP::Seq left = ntohl(edges[0]);
+		const TCP::Seq right = ntohl(edges[1]);
+		for(auto& entry : rt_queue_) {
+			auto& p = *entry.packet;
+			if(seq_geq(p.seq(), left) and seq_geq(right, p.seq() + seq_length(p)))
+				entry.sacked = true;
+		}
+	}
 }
 
 void Connection::start_time_wait_timeout() {
 	debug2("<TCP::Connection::start_time_wait_timeout> Time Wait timer started. \n");
-	time_wait_started = OS::cycles_since_boot();
 	auto timeout = 2 * host().MSL(); // 60 seconds
-	// Passing "this"..?
-	hw::PIT::instance().onTimeout(timeout,[this, timeout] {
-		// The timer hasnt been updated
-		if( OS::cycles_since_boot() >= (time_wait_started + timeout.count()) ) {
-			signal_close();
-		} else {
-			debug2("<TCP::Connection::start_time_wait_timeout> time_wait_started has been updated. \n");
-		}
+	// Restart rather than stack up timers, e.g. when the FIN is retransmitted
+	hw::PIT::instance().stop_timer(time_wait_timer_);
+	// Passing "this" is fine; the timer is stopped when we're gone
+	time_wait_timer_ = hw::PIT::instance().onTimeout(timeout,[this] {
+		time_wait_timer_ = hw::PIT::NO_TIMER;
+		signal_close();
 	});
 }
 
@@ -355,11 +1179,22 @@ std::string Connection::TCB::to_string() const {
 		<< " .UP = " << SND.UP
 		<< " .WL1 = " << SND.WL1
 		<< " .WL2 = " << SND.WL2
+		<< " .MSS = " << SND.MSS
+		<< " .WS = " << (int) SND.WS
 		<< " ISS = " << ISS
 		<< "\n RCV"
 		<< " .NXT = " << RCV.NXT
 		<< " .WND = " << RCV.WND
 		<< " .UP = " << RCV.UP
-		<< " IRS = " << IRS;
+		<< " .WS = " << (int) RCV.WS
+		<< " IRS = " << IRS
+		<< "\n RTT"
+		<< " .SRTT = " << RTT.SRTT
+		<< " .RTTVAR = " << RTT.RTTVAR
+		<< " .RTO = " << RTT.RTO
+		<< "\n TS"
+		<< " .OK = " << TS.OK
+		<< " .RECENT = " << TS.RECENT
+		<< " .LAST_ACK_SENT = " << TS.LAST_ACK_SENT;
 	return os.str();
 }
@@ -90,6 +90,13 @@ bool Connection::State::check_seq(Connection& tcp, TCP::Packet_ptr in) {
 	auto& tcb = tcp.tcb();
 	bool acceptable = false;
 	debug2("<Connection::State::check_seq> TCB: %s \n",tcb.to_string().c_str());
+	// RFC 7323 (5.3) Old duplicates, from before the sequence numbers wrapped
+	if(tcp.paws_reject(*in)) {
+		tcp.outgoing_packet()->set_seq(tcb.SND.NXT).set_ack(tcb.RCV.NXT).set_flag(ACK);
+		tcp.transmit();
+		tcp.drop(in, "PAWS.");
+		return false;
+	}
 	// #1 
 	if( in->seq() == tcb.RCV.NXT ) {
 		acceptable = true;
@@ -127,6 +134,38 @@ bool Connection::State::check_seq(Connection& tcp, TCP::Packet_ptr in) {
 	}
 	debug2("<Connection::State::check_seq> Acceptable SEQ: %u \n", in->seq());
 	// is acceptable.
+	tcp.update_ts_recent(*in);
+
+	/*
+		If a segment's contents straddle the boundary between old and new,
+		only the new parts should be processed.
+	*/
+	if(in->has_data() and !in->isset(SYN) and (int32_t)(tcb.RCV.NXT - in->seq()) > 0) {
+		uint32_t received = tcb.RCV.NXT - in->seq();
+		if(received < in->data_length())
+			in->trim_front(received);
+	}
+	/*
+		Segments with higher begining sequence numbers may be held for later processing.
+
+		RFC 5681 (4.2) A TCP receiver SHOULD send an immediate duplicate ACK
+		when an out-of-order segment arrives.
+
+		RFC 793: The segment is acceptable, only its text waits. Its ACK and
+		window are processed now, or they're lost with traffic both ways.
+		(In SYN-RECEIVED the ACK is what gets us ESTABLISHED; wait for that.)
+	*/
+	else if((in->has_data() or in->isset(FIN)) and in->seq() != tcb.RCV.NXT
+		and !in->isset(RST) and !in->isset(SYN)) {
+		// A FIN ahead of the data before it is left for the retransmission
+		if(!in->isset(FIN) and !tcp.ooo_insert(in))
+			tcp.drop(in, "Out of order queue full.");
+		if(in->isset(ACK) and !tcp.is_state(Connection::SynReceived::instance()))
+			check_ack(tcp, in);
+		tcp.outgoing_packet()->set_seq(tcb.SND.NXT).set_ack(tcb.RCV.NXT).set_flag(ACK);
+		tcp.transmit();
+		return false;
+	}
 	return true;
 }
 
@@ -174,6 +213,7 @@ bool Connection::State::check_ack(Connection& tcp, TCP::Packet_ptr in) {
     debug2("<Connection::State::check_ack> Checking for ACK in STATE: %s \n", tcp.state().to_string().c_str());
     if( in->isset(ACK) ) {
     	auto& tcb = tcp.tcb();
+    	tcp.sack_acknowledge(*in);
     	/*
 		  If SND.UNA < SEG.ACK =< SND.NXT then, set SND.UNA <- SEG.ACK.
           Any segments on the retransmission queue which are thereby
@@ -186,7 +226,9 @@ bool Connection::State::check_ack(Connection& tcp, TCP::Packet_ptr in) {
           drop the segment, and return.	
     	*/
 		if( tcb.SND.UNA < in->ack() and in->ack() <= tcb.SND.NXT ) {
+			auto acked = in->ack() - tcb.SND.UNA;
 			tcb.SND.UNA = in->ack();
+			tcp.rt_acknowledge(*in, acked);
 			// tcp.signal_sent();
 			// return that buffer has been SENT - currently no support to receipt sent buffer.
 
@@ -196,8 +238,8 @@ bool Connection::State::check_ack(Connection& tcp, TCP::Packet_ptr in) {
           		SND.WL2 =< SEG.ACK)), set SND.WND <- SEG.WND, set
           		SND.WL1 <- SEG.SEQ, and set SND.WL2 <- SEG.ACK.
 			*/
-          	if( tcb.SND.WL1 < in->seq() or ( tcb.SND.WL1 = in->seq() and tcb.SND.WL2 <= in->ack() ) ) {
-          		tcb.SND.WND = in->win();
+          	if( tcb.SND.WL1 < in->seq() or ( tcb.SND.WL1 == in->seq() and tcb.SND.WL2 <= in->ack() ) ) {
+          		tcb.SND.WND = tcp.segment_window(*in);
           		tcb.SND.WL1 = in->seq();
           		tcb.SND.WL2 = in->ack();
           	}
@@ -209,6 +251,9 @@ bool Connection::State::check_ack(Connection& tcp, TCP::Packet_ptr in) {
 	          	prevents using old segments to update the window.
           	*/
 
+          	// Window opened up; send what's waiting
+          	tcp.transmit_queued();
+
 		}
 		/* If the ACK acks something not yet sent (SEG.ACK > SND.NXT) then send an ACK, drop the segment, and return. */
 		else if( in->ack() > tcb.SND.NXT ) {
@@ -217,6 +262,15 @@ bool Connection::State::check_ack(Connection& tcp, TCP::Packet_ptr in) {
 			tcp.drop(in, "ACK > SND.NXT");
 			return false;
 		}
+		/*
+			RFC 5681 (2) DUPLICATE ACKNOWLEDGMENT: The receiver has outstanding data,
+			the segment carries no data, has neither SYN nor FIN set, acknowledges
+			SND.UNA and doesn't change the advertised window.
+		*/
+		else if( in->ack() == tcb.SND.UNA and tcp.unacknowledged() and !in->has_data()
+			and !in->isset(SYN) and !in->isset(FIN) and tcp.segment_window(*in) == tcb.SND.WND ) {
+			tcp.dup_acknowledge();
+		}
 		/* If the ACK is a duplicate (SEG.ACK < SND.UNA), it can be ignored. */
 		/*else if( in->ack() < tcb.SND.UNA ) {
 			// ignore.
@@ -270,9 +324,16 @@ void Connection::State::process_segment(Connection& tcp, TCP::Packet_ptr in) {
 		return; // Don't ACK, sender need to resend.
 	}
 	tcb.RCV.NXT += length;
-	auto snd_nxt = tcb.SND.NXT;
-	debug2("<TCP::Connection::State::process_segment> Advanced RCV.NXT: %u. SND.NXT = %u \n", tcb.RCV.NXT, snd_nxt);
-	if(in->isset(PSH)) {
+	tcp.delack_add(length);
+	/*
+		RFC 5681 (4.2) A TCP receiver SHOULD send an immediate ACK when the
+		incoming segment fills in all or part of a gap in the sequence space.
+	*/
+	const bool gap = tcp.ooo_queue_size() > 0;
+	// Segments held out of order may be in order now
+	bool push = tcp.ooo_deliver() or in->isset(PSH);
+	debug2("<TCP::Connection::State::process_segment> Advanced RCV.NXT: %u. SND.NXT = %u \n", tcb.RCV.NXT, tcb.SND.NXT);
+	if(push) {
 		debug("<TCP::Connection::State::process_segment> Packet carries PUSH. Notify user.\n");
 		tcp.signal_receive(true);
 	} else if(tcp.receive_buffer().full()) {
@@ -285,13 +346,11 @@ void Connection::State::process_segment(Connection& tcp, TCP::Packet_ptr in) {
         RCV.NXT over the data accepted, and adjusts RCV.WND as
         apporopriate to the current buffer availability.  The total of
         RCV.NXT and RCV.WND should not be reduced.
+
+        The ACK is delayed, unless it already went along with what the
+        user sent in reply.
     */
-	if(tcb.SND.NXT == snd_nxt) {
-		tcp.outgoing_packet()->set_seq(tcb.SND.NXT).set_ack(tcb.RCV.NXT).set_flag(ACK);
-		tcp.transmit();
-	} else {
-		debug2("<TCP::Connection::State::process_segment> SND.NXT > snd_nxt, this packet has already been acknowledged. \n");
-	}
+	tcp.delack_check(gap);
 	
 }
 
@@ -335,6 +394,12 @@ void Connection::State::process_fin(Connection& tcp, TCP::Packet_ptr in) {
 */
 void Connection::State::send_reset(Connection& tcp) {
 	tcp.send_buffer_.clear();
+	tcp.send_queue_.clear();
+	tcp.rt_queue_.clear();
+	tcp.rtx_stop();
+	tcp.ooo_queue_.clear();
+	tcp.delack_segments_ = 0;
+	tcp.delack_stop();
 	tcp.outgoing_packet()->set_seq(tcp.tcb().SND.NXT).set_ack(0).set_flag(RST);
 	tcp.transmit();
 }
@@ -351,6 +416,10 @@ size_t Connection::State::send(Connection&, const char*, size_t, bool) {
 	throw TCPException{"Connection closing."};
 }
 
+size_t Connection::State::send(Connection&, const Slices&, bool) {
+	throw TCPException{"Connection closing."};
+}
+
 size_t Connection::State::receive(Connection&, char*, size_t) {
 	throw TCPException{"Connection closing."};
 }
@@ -379,6 +448,7 @@ void Connection::Closed::open(Connection& tcp, bool active) {
 			tcb.ISS = tcp.generate_iss();
 			tcp.outgoing_packet()->set_seq(tcb.ISS).set_flag(SYN);
 			tcb.SND.UNA = tcb.ISS;
+			tcp.recover_ = tcb.ISS; // RFC 6582 (3.2)
 			tcb.SND.NXT = tcb.ISS+1;
 			tcp.transmit();
 			tcp.set_state(SynSent::instance());	
@@ -394,6 +464,10 @@ size_t Connection::Closed::send(Connection&, const char*, size_t, bool) {
 	throw TCPException{"Connection does not exist."};
 }
 
+size_t Connection::Closed::send(Connection&, const Slices&, bool) {
+	throw TCPException{"Connection does not exist."};
+}
+
 State::Result Connection::Closed::handle(Connection& tcp, TCP::Packet_ptr in) {
 	if(in->isset(RST)) {
 		return OK;
@@ -421,6 +495,7 @@ void Connection::Listen::open(Connection& tcp, bool) {
 		tcb.ISS = tcp.generate_iss();
 		tcp.outgoing_packet()->set_seq(tcb.ISS).set_flag(SYN);
 		tcb.SND.UNA = tcb.ISS;
+		tcp.recover_ = tcb.ISS; // RFC 6582 (3.2)
 		tcb.SND.NXT = tcb.ISS+1;
 		tcp.transmit();
 		tcp.set_state(SynSent::instance());	
@@ -447,6 +522,10 @@ size_t Connection::Listen::send(Connection&, const char*, size_t, bool) {
 	return 0;
 }
 
+size_t Connection::Listen::send(Connection&, const Slices&, bool) {
+	return 0;
+}
+
 void Connection::Listen::close(Connection& tcp) {
 	/*
 	  Any outstanding RECEIVEs are returned with "error:  closing"
@@ -479,6 +558,8 @@ State::Result Connection::Listen::handle(Connection& tcp, TCP::Packet_ptr in) {
 		tcb.ISS 		= tcp.generate_iss();
 		tcb.SND.NXT 	= tcb.ISS+1;
 		tcb.SND.UNA 	= tcb.ISS;
+		tcp.recover_ 	= tcb.ISS; // RFC 6582 (3.2)
+		tcp.parse_syn_options(*in);
 		debug("<TCP::Connection::Listen::handle> Received SYN Packet: %s TCB Updated:\n %s \n",
 			in->to_string().c_str(), tcp.tcb().to_string().c_str());
 
@@ -508,6 +589,11 @@ size_t Connection::SynSent::send(Connection& tcp, const char* buffer, size_t n,
 	return tcp.write_to_send_buffer(buffer, n, push);
 }
 
+size_t Connection::SynSent::send(Connection& tcp, const Slices& slices, bool push) {
+	// Queue the data for transmission after entering ESTABLISHED state.
+	return tcp.write_to_send_buffer(slices, push);
+}
+
 void Connection::SynSent::close(Connection& tcp) {
 	/*
 	  Delete the TCB and return "error:  closing" responses to any
@@ -594,7 +680,10 @@ State::Result Connection::SynSent::handle(Connection& tcp, TCP::Packet_ptr in) {
     if(in->isset(SYN)) {
     	tcb.RCV.NXT		= in->seq()+1;
     	tcb.IRS 		= in->seq();
+    	tcp.parse_syn_options(*in);
+    	auto acked 		= in->ack() - tcb.SND.UNA;
     	tcb.SND.UNA 	= in->ack();
+    	tcp.rt_acknowledge(*in, acked);
     	
     	// (our SYN has been ACKed)
     	if(tcb.SND.UNA > tcb.ISS) {
@@ -664,6 +753,11 @@ size_t Connection::SynReceived::send(Connection& tcp, const char* buffer, size_t
 	return tcp.write_to_send_buffer(buffer, n, push);
 }
 
+size_t Connection::SynReceived::send(Connection& tcp, const Slices& slices, bool push) {
+	// Queue the data for transmission after entering ESTABLISHED state.
+	return tcp.write_to_send_buffer(slices, push);
+}
+
 void Connection::SynReceived::close(Connection& tcp) {
 	/*
 	  If no SENDs have been issued and there is no pending data to send,
@@ -794,6 +888,13 @@ size_t Connection::Established::send(Connection& tcp, const char* buffer, size_t
 	*/
 }
 
+size_t Connection::Established::send(Connection& tcp, const Slices& slices, bool push) {
+	auto bytes_written = tcp.write_to_send_buffer(slices, push);
+	if(bytes_written)
+		tcp.transmit();
+	return bytes_written;
+}
+
 size_t Connection::Established::receive(Connection& tcp, char* buffer, size_t n) {
 	return tcp.read_from_receive_buffer(buffer, n);
 }
@@ -1003,6 +1104,13 @@ size_t Connection::CloseWait::send(Connection& tcp, const char* buffer, size_t n
 	return bytes_written;
 }
 
+size_t Connection::CloseWait::send(Connection& tcp, const Slices& slices, bool push) {
+	auto bytes_written = tcp.write_to_send_buffer(slices, push);
+	if(bytes_written)
+		tcp.transmit();
+	return bytes_written;
+}
+
 size_t Connection::CloseWait::receive(Connection& tcp, char* buffer, size_t n) {
 	return tcp.read_from_receive_buffer(buffer, n);
 }
@@ -1,11 +1,12 @@
-#define DEBUG
-#define DEBUG2
+//#define DEBUG
+//#define DEBUG2
 #include <virtio/block.hpp>
 
 #include <kernel/irq_manager.hpp>
 #include <hw/pci.hpp>
 #include <cassert>
 #include <stdlib.h>
+#include <algorithm>
 
 #define VIRTIO_BLK_F_BARRIER   0
 #define VIRTIO_BLK_F_SIZE_MAX  1
@@ -28,16 +29,25 @@
 
 #define FEAT(x)  (1 << x)
 
+// Most sectors in one request, whatever the device takes: 1MB
+static const uint64_t MAX_SECTORS = 2048;
+
 VirtioBlk::VirtioBlk(hw::PCI_Device& d)
   : Virtio(d),
-    req(queue_size(0), 0, iobase()),
-    request_counter(0)
+    req(queue_size(0), 0, iobase())
 {
   INFO("VirtioBlk", "Driver initializing");
   
   uint32_t needed_features =
       FEAT(VIRTIO_BLK_F_BLK_SIZE);
-  negotiate_features(needed_features);
+  uint32_t wanted_features = needed_features
+    | FEAT(VIRTIO_BLK_F_SIZE_MAX)
+    | FEAT(VIRTIO_BLK_F_SEG_MAX)
+    | FEAT(VIRTIO_BLK_F_RO)
+    | FEAT(VIRTIO_BLK_F_FLUSH)
+    | FEAT(VIRTIO_F_RING_EVENT_IDX)
+    | FEAT(VIRTIO_F_RING_INDIRECT_DESC);
+  negotiate_features(wanted_features);
   
   CHECK(features() & FEAT(VIRTIO_BLK_F_BARRIER),
     "Barrier is enabled");
@@ -55,6 +65,14 @@ VirtioBlk::VirtioBlk(hw::PCI_Device& d)
     "SCSI is enabled :(");
   CHECK(features() & FEAT(VIRTIO_BLK_F_FLUSH),
     "Flush enabled");
+  CHECK(features() & FEAT(VIRTIO_F_RING_EVENT_IDX),
+    "Event index is enabled");
+  CHECK(features() & FEAT(VIRTIO_F_RING_INDIRECT_DESC),
+    "Indirect descriptors are enabled");
+
+  req.set_event_idx(features() & FEAT(VIRTIO_F_RING_EVENT_IDX));
+  // Each request takes one ring slot instead of one per part
+  req.set_indirect(features() & FEAT(VIRTIO_F_RING_INDIRECT_DESC));
   
   
   CHECK ((features() & needed_features) == needed_features,
@@ -65,14 +83,27 @@ VirtioBlk::VirtioBlk(hw::PCI_Device& d)
   CHECK(success, "Request queue assigned (0x%x) to device",
     (uint32_t) req.queue_desc());
   
-  // Step 3 - Fill receive queue with buffers
-  // DEBUG: Disable
-  INFO("VirtioBlk", "Queue size: %i\tRequest size: %u\n",
-       req.size(), sizeof(request_t));
-  
   // Get device configuration
   get_config();
   
+  // Virtio Std. § 5.2.4: size_max and seg_max only hold with their features.
+  // Header and status take a descriptor each, and a request has to fit
+  // in an indirect table.
+  seg_max_  = (features() & FEAT(VIRTIO_BLK_F_SEG_MAX)) ? config.seg_max : UINT32_MAX;
+  size_max_ = (features() & FEAT(VIRTIO_BLK_F_SIZE_MAX)) ? config.size_max : UINT32_MAX;
+  seg_max_  = std::min(std::max(seg_max_, 1u), (uint32_t) Virtio::Queue::indirect_max - 2);
+  size_max_ = std::max(size_max_, (uint32_t) SECTOR_SIZE);
+  max_sectors_ = std::min<uint64_t>((uint64_t) seg_max_ * size_max_ / SECTOR_SIZE, MAX_SECTORS);
+  
+  // No more requests in the ring than descriptors
+  requests_.resize(req.size());
+  by_head_.resize(req.size(), nullptr);
+  for (auto& r : requests_)
+    free_.push_back(&r);
+  
+  INFO("VirtioBlk", "Queue size: %i\tUp to %u sectors per request",
+       req.size(), max_sectors_);
+  
   // Signal setup complete. 
   setup_complete((features() & needed_features) == needed_features);
   CHECK((features() & needed_features) == needed_features, "Signalled driver OK");
@@ -94,6 +125,11 @@ void VirtioBlk::get_config()
   Virtio::get_config(&config, sizeof(virtio_blk_config_t));
 }
 
+bool VirtioBlk::read_only() const noexcept
+{
+  return features() & FEAT(VIRTIO_BLK_F_RO);
+}
+
 void VirtioBlk::irq_handler()
 {
   debug2("<VirtioBlk> IRQ handler\n");
@@ -106,7 +142,6 @@ void VirtioBlk::irq_handler()
   // Step 2. A) - one of the queues have changed
   if (isr & 1)
   {
-    // This now means service RX & TX interchangeably
     service_RX();
   }
   
@@ -114,11 +149,7 @@ void VirtioBlk::irq_handler()
   if (isr & 2)
   {
     debug("\t <VirtioBlk> Configuration change:\n");
-    
-    // Getting the MAC + status 
-    //debug("\t             Old status: 0x%x\n", config.status);      
     get_config();
-    //debug("\t             New status: 0x%x \n", config.status);
   }
   IRQ_manager::eoi(irq());
 }
@@ -127,57 +158,175 @@ void VirtioBlk::service_RX()
 {
   req.disable_interrupts();
   
-  uint32_t received = 0;
   uint32_t len;
-  request_t* hdr;
-  blk_data_t* vbr;
-  //printf("service_RX() reading from VirtioBlk device\n");
+  uint16_t head;
   
-  while ((hdr = (request_t*) req.dequeue(len)) != nullptr)
-  {
-    printf("service_RX() received %u bytes for sector %llu\n", 
-        len, hdr->hdr.sector);
-    vbr = &hdr->data;
-    
-    printf("service_RX() received %u bytes data response\n", len);
-    printf("Received handler: %p\n", vbr->handler);
+  while (true) {
+    while (req.dequeue(len, head) != nullptr)
+      complete(by_head_[head]);
     
-    uint8_t* copy = new uint8_t[SECTOR_SIZE];
-    memcpy(copy, vbr->sector, SECTOR_SIZE);
-    auto buf = buffer_t(copy, std::default_delete<uint8_t[]>());
+    // Room in the ring again
+    send_waiting();
     
-    printf("Calling handler: %p\n", vbr->handler);
-    (*vbr->handler)(buf);
-    delete vbr->handler;
+    req.enable_interrupts();
     
-    received++;
+    // A completion may have landed before the device saw used_event
+    if (not req.new_incoming())
+      break;
+    req.disable_interrupts();
+  }
+}
+
+void VirtioBlk::submit(uint32_t type, block_t blk, block_t count, Job job)
+{
+  // Virtio Std. § 5.2.6: A flush has no data
+  if (type == VIRTIO_BLK_T_FLUSH) {
+    job->parts = 1;
+    waiting_.push_back({{type, 0, 0}, nullptr, 0, VIRTIO_BLK_S_OK, job});
   }
-  if (received == 0)
+  
+  uint8_t* data = job->buf.get();
+  while (count) {
+    auto n = std::min<block_t>(count, max_sectors_);
+    job->parts++;
+    waiting_.push_back({{type, 0, blk}, data, (uint32_t) (n * SECTOR_SIZE),
+                        VIRTIO_BLK_S_OK, job});
+    blk   += n;
+    data  += n * SECTOR_SIZE;
+    count -= n;
+  }
+  
+  send_waiting();
+}
+
+uint16_t VirtioBlk::descriptors(const request_t& r) const
+{
+  uint32_t segments = (r.len + size_max_ - 1) / size_max_;
+  return req.descriptors_needed(segments + 2);
+}
+
+void VirtioBlk::send_waiting()
+{
+  bool sent = false;
+  
+  while (not waiting_.empty()
+         and req.num_free() >= descriptors(waiting_.front()))
   {
-    //printf("service_RX() error processing requests\n");
+    auto* r = free_.back();
+    free_.pop_back();
+    *r = std::move(waiting_.front());
+    waiting_.pop_front();
+    enqueue(r);
+    sent = true;
   }
   
-  req.enable_interrupts();
+  // One kick for the whole batch
+  if (sent)
+    req.kick();
 }
 
-void VirtioBlk::read (block_t blk, on_read_func func)
+void VirtioBlk::enqueue(request_t* r)
 {
-  // Virtio Std. § 5.1.6.3
-  auto* vbr = new request_t();
+  // Virtio Std. § 5.2.6: header and data out (device-readable),
+  // or header out and data in, then the status in
+  scatterlist sg[Virtio::Queue::indirect_max];
+  uint32_t n = 0;
   
-  vbr->hdr.type   = VIRTIO_BLK_T_IN;
-  vbr->hdr.ioprio = 0;
-  vbr->hdr.sector = blk;
-  vbr->data.handler = new on_read_func(func);
-  vbr->data.status  = VIRTIO_BLK_S_OK;
+  sg[n++] = {&r->hdr, sizeof(scsi_header_t)};
+  for (uint32_t off = 0; off < r->len; off += size_max_)
+    sg[n++] = {r->data + off, (int) std::min(size_max_, r->len - off)};
+  sg[n++] = {&r->status, 1};
   
-  printf("Enqueue handler: %p\n", vbr->data.handler);
+  uint32_t out = (r->hdr.type == VIRTIO_BLK_T_OUT) ? n - 1 : 1;
+  auto head = req.enqueue(sg, out, n - out, r);
+  by_head_[head] = r;
+  inflight_count_++;
   
-  req.enqueue(&vbr->hdr, sizeof(scsi_header_t), &vbr->data, sizeof(blk_data_t));
-  req.kick();
+  debug("<VirtioBlk> Request type %u sector %llu, %u bytes (head %i)\n",
+        r->hdr.type, r->hdr.sector, r->len, head);
+}
+
+void VirtioBlk::complete(request_t* r)
+{
+  auto job = std::move(r->job);
+  if (r->status != VIRTIO_BLK_S_OK) {
+    debug("<VirtioBlk> Request for sector %llu failed: %u\n",
+          r->hdr.sector, r->status);
+    job->ok = false;
+  }
+  free_.push_back(r);
+  inflight_count_--;
+  
+  // The last part of the job
+  if (--job->parts)
+    return;
+  
+  if (job->on_read)
+    job->on_read(job->ok ? job->buf : buffer_t());
+  else if (job->on_write)
+    job->on_write(job->ok);
+}
+
+void VirtioBlk::read(block_t blk, block_t count, on_read_func func)
+{
+  if (blk + count > size() or count == 0) {
+    func(buffer_t());
+    return;
+  }
+  // The device writes straight into it
+  auto buf = buffer_t(new uint8_t[count * SECTOR_SIZE],
+                      std::default_delete<uint8_t[]>());
+  read(blk, count, buf, func);
+}
+
+void VirtioBlk::read(block_t blk, block_t count, buffer_t buf, on_read_func func)
+{
+  if (blk + count > size() or count == 0 or not buf) {
+    func(buffer_t());
+    return;
+  }
+  auto job = std::make_shared<job_t>();
+  job->buf = std::move(buf);
+  job->on_read = std::move(func);
+  submit(VIRTIO_BLK_T_IN, blk, count, std::move(job));
 }
 
-VirtioBlk::buffer_t VirtioBlk::read_sync(block_t)
+VirtioBlk::buffer_t VirtioBlk::read_sync(block_t blk)
 {
-  return buffer_t();
+  buffer_t result;
+  bool done = false;
+  read(blk, 1, [&result, &done] (buffer_t buf) {
+      result = buf;
+      done = true;
+    });
+  
+  // The IRQ is only handled once we're back in the OS loop; poll
+  while (not done)
+    service_RX();
+  
+  return result;
+}
+
+void VirtioBlk::write(block_t blk, block_t count, buffer_t buf, on_write_func func)
+{
+  if (read_only() or blk + count > size() or count == 0 or not buf) {
+    func(false);
+    return;
+  }
+  auto job = std::make_shared<job_t>();
+  job->buf = std::move(buf);
+  job->on_write = std::move(func);
+  submit(VIRTIO_BLK_T_OUT, blk, count, std::move(job));
+}
+
+void VirtioBlk::flush(on_write_func func)
+{
+  // Virtio Std. § 5.2.5: Without FLUSH the device writes through
+  if (not (features() & FEAT(VIRTIO_BLK_F_FLUSH))) {
+    func(true);
+    return;
+  }
+  auto job = std::make_shared<job_t>();
+  job->on_write = std::move(func);
+  submit(VIRTIO_BLK_T_FLUSH, 0, 0, std::move(job));
 }
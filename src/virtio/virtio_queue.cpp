@@ -29,7 +29,7 @@
 /** 
     Virtio Queue class, nested inside Virtio.
  */
-#define ALIGN(x) (((x) + PAGE_SIZE) & ~PAGE_SIZE) 
+#define ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1)) 
 unsigned Virtio::Queue::virtq_size(unsigned int qsz) 
 { 
   return ALIGN(sizeof(virtq_desc)*qsz + sizeof(u16)*(3 + qsz)) 
@@ -93,6 +93,9 @@ Virtio::Queue::Queue(uint16_t size, uint16_t q_index, uint16_t iobase)
 /** Ported more or less directly from SanOS. */
 int Virtio::Queue::enqueue(scatterlist sg[], uint32_t out, uint32_t in, void* UNUSED(data)){
   
+  if (out + in > 1 and descriptors_needed(out + in) == 1)
+    return enqueue_indirect(sg, out, in);
+
   uint16_t i,avail,head, prev = _free_head;
   
   
@@ -154,14 +157,82 @@ int Virtio::Queue::enqueue(scatterlist sg[], uint32_t out, uint32_t in, void* UN
   // Notify about free buffers
   //if (_num_free > 0) set_event(&vq->bufavail);
     
-  return _num_free;  
+  return head;
+}
+int Virtio::Queue::enqueue_indirect(scatterlist sg[], uint32_t out, uint32_t in){
+  
+  if (_num_free < 1)
+  {
+    printf("<Q %i>Buffer full (%i avail,"               \
+           " used.idx: %i, avail.idx: %i )\n",
+           _pci_index, num_avail(),
+           _queue.used->idx,_queue.avail->idx
+          );
+    panic("Buffer full");
+  }
+  
+  // Take one descriptor off the free list
+  _num_free--;
+  uint16_t head = _free_head;
+  _free_head = _queue.desc[head].next;
+  
+  // Virtio std. § 2.4.5.3: The whole chain goes in the table, outbound first
+  auto* table = indirect_table(head);
+  const uint32_t n = out + in;
+  
+  for (uint32_t i = 0; i < n; i++)
+  {
+    table[i].addr  = (intptr_t) sg[i].data;
+    table[i].len   = sg[i].size;
+    table[i].flags = (i < out ? 0 : VIRTQ_DESC_F_WRITE) 
+      | (i + 1 < n ? VIRTQ_DESC_F_NEXT : 0);
+    table[i].next  = i + 1;
+  }
+  
+  // The ring descriptor just points to the table. No NEXT, so release()
+  // frees exactly this one.
+  _queue.desc[head].addr  = (intptr_t) table;
+  _queue.desc[head].len   = n * sizeof(virtq_desc);
+  _queue.desc[head].flags = VIRTQ_DESC_F_INDIRECT;
+  
+  debug("<Q %i> Enqueueing %u tokens indirectly in %u\n", _pci_index, n, head);
+  
+  uint16_t avail = (_queue.avail->idx + _num_added++) % _size;
+  _queue.avail->ring[avail] = head;
+  
+  return head;
 }
+
+void Virtio::Queue::set_indirect(bool on)
+{
+  if (on and not _indirect)
+  {
+    // Descriptors are 16 bytes, and must be aligned as such
+    auto bytes = _size * indirect_max * sizeof(virtq_desc);
+    _indirect = (virtq_desc*) memalign(16, bytes);
+    memset(_indirect, 0, bytes);
+  }
+  else if (not on and _indirect)
+  {
+    free(_indirect);
+    _indirect = nullptr;
+  }
+}
+
 void Virtio::Queue::enqueue(
     void*    out, 
     uint32_t out_len, 
     void*    in, 
     uint32_t in_len)
 {
+  // Both ways, e.g. a request and its response, fit in one ring descriptor
+  if (out and in and indirect())
+  {
+    scatterlist sg[2] {{out, (int) out_len}, {in, (int) in_len}};
+    enqueue_indirect(sg, 1, 1);
+    return;
+  }
+  
   int total = (out) ? 1 : 0;
   total += (in) ? 1 : 0;
   
@@ -220,6 +291,12 @@ void Virtio::Queue::enqueue(
   debug("<Q%u> avail: %u\n", _pci_index, avail);
 }
 void* Virtio::Queue::dequeue(uint32_t& len)
+{
+  uint16_t head;
+  return dequeue(len, head);
+}
+
+void* Virtio::Queue::dequeue(uint32_t& len, uint16_t& head)
 {
   // Return NULL if there are no more completed buffers in the queue
   if (_last_used_idx == _queue.used->idx)
@@ -232,8 +309,9 @@ void* Virtio::Queue::dequeue(uint32_t& len)
   auto& e = _queue.used->ring[_last_used_idx % _size];
 
   debug2("<Q %i> Releasing token %li. Len: %li\n",_pci_index, e.id, e.len);
-  void* data = (void*) _queue.desc[e.id].addr;
+  void* data = desc_data(e.id);
   len = e.len;
+  head = e.id;
   
   // Release buffer
   release(e.id);
@@ -278,7 +356,7 @@ uint8_t* Virtio::Queue::dequeue(uint32_t* len){
   *len = e->len;
 
   debug2("<Q %i> Releasing token %li. Len: %li\n",_pci_index,e->id, e->len);
-  uint8_t* data = (uint8_t*)_queue.desc[e->id].addr;
+  uint8_t* data = (uint8_t*) desc_data(e->id);
   
   // Release buffer
   release(e->id);
@@ -292,11 +370,21 @@ void Virtio::Queue::set_data_handler(delegate<int(uint8_t* data,int len)> del){
 }
 
 void Virtio::Queue::disable_interrupts(){
-  _queue.avail->flags |= (1 << VIRTQ_AVAIL_F_NO_INTERRUPT);
+  _queue.avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
 }
 
 void Virtio::Queue::enable_interrupts(){
-  _queue.avail->flags &= ~(1 << VIRTQ_AVAIL_F_NO_INTERRUPT);
+  enable_interrupts(1);
+}
+
+void Virtio::Queue::enable_interrupts(uint16_t n){
+  _queue.avail->flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+  if (_event_idx)
+    used_event() = _last_used_idx + (n ? n : 1) - 1;
+
+  // Make sure the device sees it before we check for more used buffers
+  __sync_synchronize();
 }
 
 void Virtio::Queue::kick(){
@@ -304,13 +392,22 @@ void Virtio::Queue::kick(){
 
   // Atomically increment (maybe not necessary?)
   //__sync_add_and_fetch(&(_queue.avail->idx),_num_added); 
-  _queue.avail->idx += _num_added;
-  //__sync_synchronize ();
+  uint16_t old_idx = _queue.avail->idx;
+  uint16_t new_idx = old_idx + _num_added;
+  _queue.avail->idx = new_idx;
 
   _num_added = 0;
- 
 
-  if (!(_queue.used->flags & VIRTQ_USED_F_NO_NOTIFY)){
+  // The device has to see the new index before we ask if it wants to know
+  __sync_synchronize();
+
+  // With EVENT_IDX the device tells us how far it has come, and only
+  // wants a kick if we've passed that. Saves a VM exit per batch.
+  bool notify = _event_idx
+    ? need_event(avail_event(), new_idx, old_idx)
+    : !(_queue.used->flags & VIRTQ_USED_F_NO_NOTIFY);
+
+  if (notify){
     debug("<Queue %i> Kicking virtio. Iobase 0x%x \n",
           _pci_index, _iobase);
     //hw::outpw(_iobase + VIRTIO_PCI_QUEUE_SEL, _pci_index);
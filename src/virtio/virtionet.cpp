@@ -30,6 +30,7 @@
 
 using namespace net;
 constexpr VirtioNet::virtio_net_hdr VirtioNet::empty_header;
+constexpr VirtioNet::virtio_net_hdr_mrg_rxbuf VirtioNet::empty_header_mrg;
 
 const char* VirtioNet::name(){ return "VirtioNet Driver"; }
 const net::Ethernet::addr& VirtioNet::mac(){ return _conf.mac; }
@@ -55,14 +56,24 @@ VirtioNet::VirtioNet(hw::PCI_Device& d)
   uint32_t needed_features = 0
     | (1 << VIRTIO_NET_F_MAC)
     | (1 << VIRTIO_NET_F_STATUS);
-  //| (1 << VIRTIO_NET_F_MRG_RXBUF); //Merge RX Buffers (Everything i 1 buffer)
-  uint32_t wanted_features = needed_features; /*;
+  uint32_t wanted_features = needed_features
     | (1 << VIRTIO_NET_F_CSUM)
+    | (1 << VIRTIO_NET_F_GUEST_CSUM)
+    | (1 << VIRTIO_NET_F_HOST_TSO4)
+    | (1 << VIRTIO_NET_F_MRG_RXBUF)   // Frames may span several RX buffers,
+    | (1 << VIRTIO_NET_F_GUEST_TSO4)  // so the host can pass on 64KB segments
+    | (1 << VIRTIO_F_RING_EVENT_IDX)
+    | (1 << VIRTIO_F_RING_INDIRECT_DESC);
+  /*
     | (1 << VIRTIO_F_ANY_LAYOUT)
     | (1 << VIRTIO_NET_F_CTRL_VQ)
     | (1 << VIRTIO_NET_F_GUEST_ANNOUNCE)
     | (1 << VIRTIO_NET_F_CTRL_MAC_ADDR);*/
 
+  // Large segments need mergeable buffers to land in. Don't ask without.
+  if (not (probe_features() & (1 << VIRTIO_NET_F_MRG_RXBUF)))
+    wanted_features &= ~(1 << VIRTIO_NET_F_GUEST_TSO4);
+
   negotiate_features(wanted_features);
 
 
@@ -78,6 +89,9 @@ VirtioNet::VirtioNet(hw::PCI_Device& d)
   CHECK(features() & (1 << VIRTIO_NET_F_GUEST_CSUM),
 	"Guest handles packets w. partial checksum");
 
+  CHECK(features() & (1 << VIRTIO_NET_F_HOST_TSO4),
+        "Device handles TCP segmentation (TSO)");
+
   CHECK(features() & (1 << VIRTIO_NET_F_CTRL_VQ),
        "There's a control queue");
 
@@ -99,6 +113,19 @@ VirtioNet::VirtioNet(hw::PCI_Device& d)
   CHECK(features() & (1 << VIRTIO_NET_F_MRG_RXBUF),
 	"Merge RX buffers");
 
+  CHECK(features() & (1 << VIRTIO_NET_F_GUEST_TSO4),
+	"Guest receives large TCP segments (LRO)");
+
+
+  // Interrupt and kick thresholds, instead of on/off flags
+  rx_q.set_event_idx(features() & (1 << VIRTIO_F_RING_EVENT_IDX));
+  tx_q.set_event_idx(features() & (1 << VIRTIO_F_RING_EVENT_IDX));
+
+  // Header + data in one ring slot. Mergeable RX buffers are one descriptor
+  // already, so RX only needs it for header + data pairs.
+  tx_q.set_indirect(features() & (1 << VIRTIO_F_RING_INDIRECT_DESC));
+  rx_q.set_indirect(features() & (1 << VIRTIO_F_RING_INDIRECT_DESC)
+                    and not mergeable_rx());
 
   // Step 1 - Initialize RX/TX queues
   auto success = assign_queue(0, (uint32_t)rx_q.queue_desc());
@@ -109,6 +136,9 @@ VirtioNet::VirtioNet(hw::PCI_Device& d)
   CHECK(success, "TX queue assigned (0x%x) to device",
 	(uint32_t)tx_q.queue_desc());
 
+  // One slot per descriptor; a frame is known by its head descriptor
+  tx_inflight_.resize(tx_q.size());
+
   // Step 2 - Initialize Ctrl-queue if it exists
   if (features() & (1 << VIRTIO_NET_F_CTRL_VQ)) {
     success = assign_queue(2, (uint32_t)tx_q.queue_desc());
@@ -117,11 +147,19 @@ VirtioNet::VirtioNet(hw::PCI_Device& d)
   }
 
   // Step 3 - Fill receive queue with buffers
-  // DEBUG: Disable
+  // Mergeable buffers take one descriptor each, otherwise header + data
+  const int rx_bufs = rx_q.size() / rx_q.descriptors_needed(mergeable_rx() ? 1 : 2);
   INFO("VirtioNet", "Adding %i receive buffers of size %i",
-       rx_q.size() / 2, Packet::MTU+sizeof(virtio_net_hdr));
+       rx_bufs, bufstore_.raw_bufsize());
 
-  for (int i = 0; i < rx_q.size() / 2; i++) add_receive_buffer();
+  for (int i = 0; i < rx_bufs; i++)
+    if (add_receive_buffer() < 0)
+      rx_deficit_++;
+
+  // Start dropping incoming frames when the buffers left won't cover
+  // another full RX ring, so that upper layers can still transmit.
+  bufstore_.on_low_watermark(rx_q.size() / 2,
+    net::BufferStore::watermark_del::from<VirtioNet, &VirtioNet::on_low_buffers>(this));
 
   // Step 4 - If there are many queues, we should negotiate the number.
   // Set config length, based on whether there are multiple queues
@@ -140,7 +178,8 @@ VirtioNet::VirtioNet(hw::PCI_Device& d)
 	_conf.mac.str().c_str());
 
 
-  // Step 7 - 9 - GSO: @todo Not using GSO features yet.
+  // Step 7 - 9 - GSO: Only HOST_TSO4, negotiated above. TCP asks tso()
+  // and sends large segments, which tx_header() passes on to the host.
 
   // Signal setup complete.
   setup_complete((features() & needed_features) == needed_features);
@@ -161,29 +200,44 @@ VirtioNet::VirtioNet(hw::PCI_Device& d)
 
 /** Port-ish from SanOS */
 int VirtioNet::add_receive_buffer(){
-  virtio_net_hdr* hdr;
-  scatterlist sg[2];
-
   // Virtio Std. § 5.1.6.3
   auto buf = bufstore_.get_raw_buffer();
 
+  // Storage ceiling reached - the caller keeps count, and tries again later
+  if (not buf)
+    return -1;
+
   debug2("<VirtioNet> Added receive-bufer @ 0x%lx \n", (uint32_t)buf);
 
-  hdr = (virtio_net_hdr*)buf;
+  recycle_receive_buffer(buf);
+  return 0;
+}
 
-  sg[0].data = hdr;
+
+void VirtioNet::recycle_receive_buffer(uint8_t* buf){
+  // Mergeable: One descriptor. The header goes first, then the frame
+  // (which may continue in the next buffers)
+  if (mergeable_rx()) {
+    scatterlist sg[1];
+    sg[0].data = buf;
+    sg[0].size = bufstore_.raw_bufsize();
+    rx_q.enqueue(sg, 0, 1, buf);
+    return;
+  }
 
   //NOTE: using separate empty header doesn't work for RX, but it works for TX...
-  //sg[0].data = (void*)&empty_header;
+  scatterlist sg[2];
+  sg[0].data = rx_header(buf);
   sg[0].size = sizeof(virtio_net_hdr);
-  sg[1].data = buf + sizeof(virtio_net_hdr);
-  sg[1].size = Packet::MTU;
-  rx_q.enqueue(sg, 0, 2,buf);
-
-  return 0;
+  sg[1].data = buf + rx_headroom;
+  sg[1].size = max_frame;
+  rx_q.enqueue(sg, 0, 2, buf);
 }
 
-
+void VirtioNet::on_low_buffers(net::BufferStore& store){
+  INFO("VirtioNet", "Low on buffers (%u of max %u left). Shedding RX load",
+       store.headroom(), store.max_buffers());
+}
 
 void VirtioNet::irq_handler(){
 
@@ -196,6 +250,7 @@ void VirtioNet::irq_handler(){
 
   // Step 2. A) - one of the queues have changed
   if (isr & 1){
+    rx_interrupts_++;
 
     // This now means service RX & TX interchangeably
     service_RX();
@@ -223,72 +278,188 @@ void VirtioNet::service_RX(){
   debug2("<RX Queue> %i new packets, %i available tokens \n",
         rx_q.new_incoming(),rx_q.num_avail());
 
+  rx_deferred_ = false;
 
   /** For RX, we dequeue, add new buffers and let receiver is responsible for
       memory management (they know when they're done with the packet.) */
 
-  int i = 0;
+  int received = 0;
+  int used = 0;
   uint32_t len = 0;
-  uint8_t* data;
 
+  // No interrupts while we're at it - we'll look again before leaving
   rx_q.disable_interrupts();
-  // A zipper, alternating between sending and receiving
-  while(rx_q.new_incoming() or tx_q.new_incoming()){
-
-    // Do one RX-packet
-    if (rx_q.new_incoming() ){
-      data = rx_q.dequeue(&len); //BUG # 102? + sizeof(virtio_net_hdr);
-
-      auto pckt_ptr = std::make_shared<Packet>
-        (data+sizeof(virtio_net_hdr), // Offset buffer (bufstore knows the offset)
-	 MTU()-sizeof(virtio_net_hdr), // Capacity
-	 len - sizeof(virtio_net_hdr), release_buffer); // Size
 
+  while (received < rx_budget_ and rx_q.new_incoming()) {
+    // The head descriptor holds the header, not necessarily the buffer start
+    auto buf = rx_buffer(rx_q.dequeue(&len));
+    auto pckt_ptr = receive_frame(buf, len, used);
+    if (pckt_ptr)
       _link_out(pckt_ptr);
+    received++;
+  }
+  rx_packets_ += received;
 
-      // Requeue a new buffer
-      add_receive_buffer();
+  // Refill in one go, and publish the whole batch with a single kick.
+  // Buffers we can't get now are tried for again next time round.
+  const int wanted = used + rx_deficit_;
+  int added = 0;
+  while (added < wanted and add_receive_buffer() == 0)
+    added++;
+  rx_deficit_ = wanted - added;
 
-      i++;
+  // Reclaim sent buffers while we're here
+  service_TX();
 
-    }
-    debug2("<VirtioNet> Service loop about to kick RX if %i \n",i);
+  debug2("<VirtioNet> Received %i frames. Kicking RX \n", received);
+  if (received or added)
+    rx_q.kick();
 
-    if (i)
-      rx_q.kick();
+  // Budget spent: let others have a go, and come back from the event loop
+  if (rx_q.new_incoming())
+    return defer_RX();
 
-    // Do one TX-packet
-    if (tx_q.new_incoming()){
-      tx_q.dequeue(&len);
-    }
+  rx_q.enable_interrupts();
 
-    rx_q.enable_interrupts();
+  // Frames that arrived before interrupts were back on won't raise one
+  if (rx_q.new_incoming()) {
+    rx_q.disable_interrupts();
+    return defer_RX();
   }
 
   debug2("<VirtioNet> Done servicing queues\n");
 }
 
+void VirtioNet::defer_RX(){
+  if (rx_deferred_)
+    return;
+
+  rx_deferred_ = true;
+  IRQ_manager::defer(delegate<void()>::from<VirtioNet,&VirtioNet::service_RX>(this));
+}
+
+Packet_ptr VirtioNet::receive_frame(uint8_t* buf, uint32_t len, int& used){
+  auto* hdr = rx_header(buf);
+  int buffers = mergeable_rx()
+    ? reinterpret_cast<virtio_net_hdr_mrg_rxbuf*>(hdr)->num_buffers : 1;
+
+  // Used length counts the header as well
+  uint32_t frame_len = len - (mergeable_rx() ? rx_headroom : sizeof(virtio_net_hdr));
+
+  // Running out of buffers: shed load by recycling the buffers
+  // instead of passing the frame on, keeping the rest for TX.
+  // Never pass on buffers that can't be replaced, or the ring shrinks.
+  if (bufstore_.low()
+      or bufstore_.headroom() < size_t(rx_deficit_ + used + buffers)) {
+    debug("<VirtioNet> Low on buffers. Dropping frame. \n");
+    recycle_receive_buffer(buf);
+    while (--buffers > 0)
+      recycle_receive_buffer(rx_buffer(rx_q.dequeue(&len)));
+    return nullptr;
+  }
+
+  auto pckt_ptr = Packet::create
+    (buf + rx_headroom,                         // Offset buffer (bufstore knows the offset)
+     bufstore_.offset_bufsize(),                // Capacity
+     frame_len, release_buffer);                // Size
+
+  // The host either checked the checksum, or never computed it
+  // (e.g. a local peer, doing offload too). Either way, trust it.
+  if (hdr->flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM))
+    pckt_ptr->set_csum_verified();
+  used++;
+
+  // The rest of a merged frame is just data, filling whole buffers
+  Packet_ptr tail = pckt_ptr;
+  while (--buffers > 0) {
+    auto data = rx_buffer(rx_q.dequeue(&len));
+    auto next = Packet::create(data, bufstore_.raw_bufsize(), len, release_raw_buffer);
+    tail->chain(next);
+    tail = next;
+    used++;
+  }
+
+  debug2("<VirtioNet> Received %i byte frame in %i buffers \n",
+         pckt_ptr->chain_size(), pckt_ptr->chain_length());
+  return pckt_ptr;
+}
+
 void VirtioNet::service_TX(){
   debug2("<TX Queue> %i transmitted, %i waiting packets\n",
         tx_q.new_incoming(),tx_q.num_avail());
 
   uint32_t len = 0;
+  uint16_t head = 0;
   int i = 0;
 
-  /** For TX, just dequeue all incoming tokens.
-
-      Sender allocated the buffer and is responsible for memory management.
-      @todo Sender doesn't know when the packet is transmitted; deal with it. */
-  for (;i < tx_q.new_incoming(); i++)
-    tx_q.dequeue(&len);
+  /** For TX, the device is done reading these, so we can let go of them.
+      Whoever else holds on to the packets decides when the buffers go back. */
+  for (; tx_q.new_incoming(); i++) {
+    tx_q.dequeue(len, head);
+    tx_inflight_[head].reset();
+  }
 
   debug2("\t Dequeued %i packets \n",i);
-  // Deallocate buffer.
+
+  if (not i)
+    return;
+
+  // Frames waiting for room go first
+  int sent = 0;
+  while (not tx_backlog_.empty() and tx_room(*tx_backlog_.front())) {
+    enqueue_tx(std::move(tx_backlog_.front()));
+    tx_backlog_.pop_front();
+    sent++;
+  }
+
+  if (sent)
+    tx_q.kick();
+
+  if (tx_backlog_.empty() and transmit_queue_available_event_)
+    transmit_queue_available_event_(transmit_queue_available());
 }
 
-void VirtioNet::transmit(net::Packet_ptr pckt){
-  debug2("<VirtioNet> Enqueuing %lib of data. \n",pckt->len());
+const VirtioNet::virtio_net_hdr* VirtioNet::tx_header(net::Packet& pckt){
+  // The mergeable header only adds num_buffers at the end
+  auto* empty = mergeable_rx()
+    ? reinterpret_cast<const virtio_net_hdr*>(&empty_header_mrg) : &empty_header;
+
+  if (not pckt.csum_partial())
+    return empty;
+
+  // The header goes in the headroom the bufstore leaves in front of each
+  // buffer. Without offload, or a buffer from elsewhere, do it in software.
+  auto buf = pckt.buffer();
+  if (not checksum_offload()
+      or not bufstore_.address_is_from_pool(buf)
+      or not bufstore_.address_is_offset_bufstart(buf)) {
+    pckt.complete_checksum();
+    return empty;
+  }
 
+  auto* hdr = reinterpret_cast<virtio_net_hdr*>(buf - tx_header_size());
+  if (mergeable_rx())
+    reinterpret_cast<virtio_net_hdr_mrg_rxbuf*>(hdr)->num_buffers = 0;
+  hdr->flags       = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+  if (pckt.gso_size() and tso()) {
+    hdr->gso_type  = VIRTIO_NET_HDR_GSO_TCPV4;
+    hdr->hdr_len   = pckt.gso_hdr_len();
+    hdr->gso_size  = pckt.gso_size();
+  } else {
+    hdr->gso_type  = VIRTIO_NET_HDR_GSO_NONE;
+    hdr->hdr_len   = 0;
+    hdr->gso_size  = 0;
+  }
+  hdr->csum_start  = pckt.csum_start();
+  hdr->csum_offset = pckt.csum_offset();
+  return hdr;
+}
+
+bool VirtioNet::tx_room(const net::Packet& pckt){
+  return tx_q.num_free() >= tx_q.descriptors_needed(1 + pckt.chain_length());
+}
+
+void VirtioNet::enqueue_tx(net::Packet_ptr pckt){
 
   /** @note We have to send a virtio header first, then the packet.
 
@@ -302,18 +473,49 @@ void VirtioNet::transmit(net::Packet_ptr pckt){
       support VirtualBox
   */
 
-  // A scatterlist for virtio-header + data
-  scatterlist sg[2];
+  // A scatterlist for virtio-header + data, which may be chained (TSO)
+  const int pieces = 1 + pckt->chain_length();
+  scatterlist sg[pieces];
 
   // This setup requires all tokens to be pre-chained like in SanOS
-  sg[0].data = (void*)&empty_header;
-  sg[0].size = sizeof(virtio_net_hdr);
-  sg[1].data = (void*)pckt->buffer();
-  sg[1].size = pckt->size();
+  sg[0].data = (void*)tx_header(*pckt);
+  sg[0].size = tx_header_size();
+
+  int i = 1;
+  for (auto p = pckt; p; p = p->unchain(), i++) {
+    sg[i].data = (void*)p->buffer();
+    sg[i].size = p->size();
+  }
+
+  // Enqueue scatterlist, all pieces readable, 0 writable.
+  auto head = tx_q.enqueue(sg, pieces, 0, 0);
+
+  // Keep the buffers alive until the device is done with them
+  tx_inflight_[head] = std::move(pckt);
+}
+
+void VirtioNet::transmit(net::Packet_ptr pckt){
+  debug2("<VirtioNet> Enqueuing %lib of data. \n",pckt->len());
+
+  // Make room, if the device has sent anything since last time
+  if (not tx_room(*pckt))
+    service_TX();
+
+  // Still full (or others are waiting). Wait for the device to catch up.
+  if (not tx_backlog_.empty() or not tx_room(*pckt)) {
+    debug("<VirtioNet> TX ring full. %u frames waiting\n", tx_backlog_.size());
+    tx_ring_full_++;
+    tx_backlog_.push_back(std::move(pckt));
+    // Make sure we hear about it as soon as something is sent
+    tx_q.enable_interrupts();
+    return;
+  }
 
-  // Enqueue scatterlist, 2 pieces readable, 0 writable.
-  tx_q.enqueue(sg, 2, 0, 0);
+  enqueue_tx(std::move(pckt));
 
   tx_q.kick();
 
+  // No need to hear about every sent frame. With EVENT_IDX, wait until
+  // 3/4 of what's in flight is done before reclaiming.
+  tx_q.enable_interrupts((tx_q.num_avail() + tx_q.new_incoming()) * 3 / 4);
 }
@@ -0,0 +1,140 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ *  BufferStore micro-benchmark.
+ *
+ *  Measures get/release pairs per second for the BufferStore, next to a
+ *  std::deque based FIFO freelist (what BufferStore used before) as the
+ *  baseline. Two patterns are run:
+ *
+ *  - pingpong: get one buffer, release it right away (RX fast path)
+ *  - burst:    get BURST buffers, then release them all (TX bursts)
+ */
+
+#include <os>
+#include <stdio.h>
+#include <deque>
+#include <malloc.h>
+#include <net/buffer_store.hpp>
+
+using namespace std::chrono;
+
+static const size_t BUFCOUNT  = 1024;
+static const size_t BUFSIZE   = 1520;
+static const size_t OFFSET    = 10;
+static const size_t BURST     = 64;
+static const size_t ROUNDS    = 1000000;
+
+// The old freelist, kept here as the baseline
+class DequeStore {
+public:
+  using buffer_t = uint8_t*;
+
+  DequeStore(size_t num, size_t bufsize) :
+    pool_ {static_cast<buffer_t>(memalign(PAGE_SIZE, num * bufsize))}
+  {
+    for (buffer_t b = pool_; b < pool_ + num * bufsize; b += bufsize)
+      available_.push_back(b);
+  }
+
+  ~DequeStore() { free(pool_); }
+
+  buffer_t get_raw_buffer() {
+    auto buf = available_.front();
+    available_.pop_front();
+    return buf;
+  }
+
+  void release_raw_buffer(buffer_t b)
+  { available_.push_back(b); }
+
+private:
+  buffer_t pool_;
+  std::deque<buffer_t> available_;
+};
+
+// Keep the compiler from optimizing the buffers away
+static volatile uint8_t sink;
+
+template <typename Store>
+static uint64_t pingpong(Store& store) {
+  auto t0 = OS::cycles_since_boot();
+  for (size_t i = 0; i < ROUNDS; ++i) {
+    auto buf = store.get_raw_buffer();
+    sink = buf[OFFSET];
+    store.release_raw_buffer(buf);
+  }
+  return OS::cycles_since_boot() - t0;
+}
+
+template <typename Store>
+static uint64_t burst(Store& store) {
+  uint8_t* bufs[BURST];
+  auto t0 = OS::cycles_since_boot();
+  for (size_t i = 0; i < ROUNDS / BURST; ++i) {
+    for (size_t n = 0; n < BURST; ++n) {
+      bufs[n] = store.get_raw_buffer();
+      sink = bufs[n][OFFSET];
+    }
+    for (size_t n = 0; n < BURST; ++n)
+      store.release_raw_buffer(bufs[n]);
+  }
+  return OS::cycles_since_boot() - t0;
+}
+
+// Adapt BufferStore to the same interface as the baseline
+struct PooledStore {
+  net::BufferStore store {BUFCOUNT, BUFSIZE, OFFSET};
+
+  uint8_t* get_raw_buffer()
+  { return store.get_raw_buffer(); }
+
+  void release_raw_buffer(uint8_t* b)
+  { store.release_raw_buffer(b, BUFSIZE); }
+};
+
+static void report(const char* name, uint64_t cycles, size_t ops) {
+  double hz = Hz(hw::PIT::CPUFrequency()).count();
+  double secs = cycles / hz;
+  printf("%-22s %8.2f cycles/op  %12.0f allocs/sec\n",
+         name, (double) cycles / ops, ops / secs);
+}
+
+void Service::start()
+{
+  printf("*** BufferStore benchmark: %u buffers of %u bytes, %u rounds ***\n",
+         BUFCOUNT, BUFSIZE, ROUNDS);
+
+  // Let the CPU frequency estimate settle before converting cycles
+  hw::PIT::instance().onTimeout(1s, []{
+      DequeStore  deq {BUFCOUNT, BUFSIZE};
+      PooledStore lifo;
+
+      // Warm up both
+      pingpong(deq);
+      pingpong(lifo);
+
+      report("deque    pingpong", pingpong(deq), ROUNDS);
+      report("freelist pingpong", pingpong(lifo), ROUNDS);
+      report("deque    burst",    burst(deq), ROUNDS / BURST * BURST);
+      report("freelist burst",    burst(lifo), ROUNDS / BURST * BURST);
+
+      CHECK(lifo.store.available() == BUFCOUNT, "All buffers returned to the store");
+      printf("*** BufferStore benchmark done ***\n");
+    });
+}
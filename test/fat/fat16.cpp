@@ -21,6 +21,22 @@
 
 #include <memdisk>
 
+static const std::string internal_banana =
+R"(     ____                           ___
+    |  _ \  ___              _   _.' _ `.
+ _  | [_) )' _ `._   _  ___ ! \ | | (_) |    _
+|:;.|  _ <| (_) | \ | |' _ `|  \| |  _  |  .:;|
+|   `.[_) )  _  |  \| | (_) |     | | | |.',..|
+':.   `. /| | | |     |  _  | |\  | | |.' :;::'
+ !::,   `-!_| | | |\  | | | | | \ !_!.'   ':;!
+ !::;       ":;:!.!.\_!_!_!.!-'-':;:''    '''!
+ ';:'        `::;::;'             ''     .,  .
+   `:     .,.    `'    .::... .      .::;::;'
+     `..:;::;:..      ::;::;:;:;,    :;::;'
+       "-:;::;:;:      ':;::;:''     ;.-'
+           ""`---...________...---'""
+)";
+
 void Service::start()
 {
   INFO("FAT16", "Running tests for FAT16");
@@ -77,24 +93,18 @@ void Service::start()
     auto buf = fs.read(ent, 0, ent.size);
     std::string banana((char*) buf.buffer.get(), buf.len);
     
-    std::string internal_banana = 
-    R"(     ____                           ___
-    |  _ \  ___              _   _.' _ `.
- _  | [_) )' _ `._   _  ___ ! \ | | (_) |    _
-|:;.|  _ <| (_) | \ | |' _ `|  \| |  _  |  .:;|
-|   `.[_) )  _  |  \| | (_) |     | | | |.',..|
-':.   `. /| | | |     |  _  | |\  | | |.' :;::'
- !::,   `-!_| | | |\  | | | | | \ !_!.'   ':;!
- !::;       ":;:!.!.\_!_!_!.!-'-':;:''    '''!
- ';:'        `::;::;'             ''     .,  .
-   `:     .,.    `'    .::... .      .::;::;'
-     `..:;::;:..      ::;::;:;:;,    :;::;'
-       "-:;::;:;:      ':;::;:''     ;.-'
-           ""`---...________...---'""
-)";
     CHECK(banana == internal_banana, "Correct banana");
     printf("%s\n", banana.c_str());
     
+    // read the whole file, following its cluster chain
+    fs.readFile("/banana.txt",
+    [] (fs::error_t err, fs::buffer_t buf, uint64_t len)
+    {
+      CHECK(!err, "readFile banana.txt");
+      assert(!err);
+      std::string banana((char*) buf.get(), len);
+      CHECK(banana == internal_banana, "readFile gave the correct banana");
+    });
   });
   
   INFO("FAT16", "SUCCESS");
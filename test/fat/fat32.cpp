@@ -96,6 +96,21 @@ void Service::start()
     CHECK(ent.name() == "banana.txt", "Name is 'banana.txt'");
     assert(ent.name() == "banana.txt");
     
+    // the path is indexed now, so this one doesn't touch the disk
+    auto again = fs.stat("/dir1/dir2/dir3/dir4/dir5/dir6/banana.txt");
+    CHECK(again.is_valid() && again.block == ent.block, "Stat deep file again");
+    assert(again.block == ent.block);
+    
+    auto none = fs.stat("/dir1/dir2/dir3/dir4/dir5/dir6/apple.txt");
+    CHECK(!none.is_valid(), "No apple in indexed dir");
+    assert(!none.is_valid());
+    
+    fs.readFile("/dir1/dir2/dir3/dir4/dir5/dir6/banana.txt",
+    [ent] (fs::error_t err, fs::buffer_t, uint64_t len)
+    {
+      CHECK(!err && len == ent.size, "readFile deep banana");
+      assert(!err);
+    });
   });
   
   INFO("FAT32", "SUCCESS");
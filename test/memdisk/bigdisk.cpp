@@ -18,8 +18,10 @@
 #include <os>
 #include <stdio.h>
 #include <cassert>
+#include <cstring>
 
 #include <memdisk>
+#include <hw/block_cache.hpp>
 
 void Service::start()
 {
@@ -46,5 +48,37 @@ void Service::start()
   assert(mbr[0x1FE] == 0x55);
   assert(mbr[0x1FF] == 0xAA);
   
+  // the same sectors again, through a block cache
+  hw::BlockCache cache {disk->dev(), 64 * 1024, 4};
+  for (int round = 0; round < 2; round++)
+    for (hw::IDiskDevice::block_t blk = 0; blk < 8; blk++)
+      cache.read(blk, [blk] (hw::IDiskDevice::buffer_t buf) {
+          CHECK(!!buf, "Cached read of sector %llu", blk);
+        });
+  // three misses: the first read isn't sequential, the next two read
+  // three sectors ahead each
+  CHECK(cache.misses() == 3 and cache.hits() == 13,
+        "Reads from cache (%llu hits, %llu misses)", cache.hits(), cache.misses());
+  CHECK(cache.read_ahead() == 6, "Read %llu sectors ahead", cache.read_ahead());
+  CHECK(memcmp(cache.read_sync(0).get(), mbr, 512) == 0, "Cached sector 0 matches");
+  
+  // sectors 6 - 8 are cached, 9 isn't: only that one is a miss
+  auto hits = cache.hits();
+  auto misses = cache.misses();
+  cache.read(6, 4, [] (hw::IDiskDevice::buffer_t buf) {
+      CHECK(!!buf, "Partly cached read of 4 sectors");
+    });
+  CHECK(cache.hits() == hits + 3 and cache.misses() == misses + 1,
+        "Partly cached read (%llu hits, %llu misses)", cache.hits(), cache.misses());
+  
+  // a large read streams past the cache, leaving what's there alone
+  auto cached = cache.cached();
+  cache.read(100, 64, [] (hw::IDiskDevice::buffer_t buf) {
+      CHECK(!!buf, "Streamed read of 64 sectors");
+    });
+  CHECK(cache.streamed() == 64 and cache.cached() == cached,
+        "Large read not cached (%llu streamed, %u cached)",
+        cache.streamed(), cache.cached());
+  
   INFO("MemDisk", "SUCCESS");
 }
@@ -50,6 +50,18 @@ void Service::start()
   CHECK(test1 == test2, "Binary comparison of sector data");
   assert(test1 == test2);
   
+  // reads are views into the image, not copies
+  auto again = disk->dev().read_sync(0);
+  CHECK(again.get() == buf.get(), "Sector 0 read twice is the same memory");
+  assert(again.get() == buf.get());
+  
+  disk->dev().read(0, 2,
+  [&buf] (fs::buffer_t both)
+  {
+    CHECK(both.get() == buf.get(), "Sectors 0-1 start at sector 0");
+    assert(both.get() == buf.get());
+  });
+  
   // verify that reading outside of disk returns a 0x0 pointer
   buf = disk->dev().read_sync(disk->dev().size());
   CHECK(!buf, "Buffer outside of disk range (sector=%llu) is 0x0",
@@ -0,0 +1,135 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ *  TCP demux micro-benchmark.
+ *
+ *  Measures the cost of finding the connection for an incoming segment,
+ *  with the hashed table TCP::bottom uses next to the std::map it used
+ *  before, at 10, 1k and 10k connections. Two patterns are run:
+ *
+ *  - spread: every lookup for a random connection
+ *  - runs:   RUN lookups in a row for the same connection (bulk transfer)
+ */
+
+#include <os>
+#include <stdio.h>
+#include <map>
+#include <vector>
+#include <net/tcp.hpp>
+
+using namespace std::chrono;
+using namespace net;
+
+using Tuple = TCP::Connection::Tuple;
+using Conn  = std::shared_ptr<TCP::Connection>;
+using Table = HashTable<Tuple, Conn, TCP::Connection::Tuple_hash>;
+
+static const size_t LOOKUPS = 1000000;
+static const size_t RUN     = 8;
+
+// Keep the compiler from optimizing the lookups away
+static volatile size_t sink;
+
+static std::vector<Tuple> make_tuples(size_t n) {
+  std::vector<Tuple> tuples;
+  for (size_t i = 0; i < n; i++) {
+    IP4::addr addr;
+    addr.whole = rand();
+    tuples.emplace_back(TCP::Port(80), TCP::Socket{addr, TCP::Port(1024 + rand() % 60000)});
+  }
+  return tuples;
+}
+
+// Indices into the tuples, the same sequence for both tables
+static std::vector<uint32_t> make_order(size_t n, size_t run) {
+  std::vector<uint32_t> order;
+  while (order.size() < LOOKUPS) {
+    auto i = rand() % n;
+    for (size_t r = 0; r < run; r++)
+      order.push_back(i);
+  }
+  return order;
+}
+
+static uint64_t lookup(std::map<Tuple, Conn>& map,
+                       const std::vector<Tuple>& tuples,
+                       const std::vector<uint32_t>& order) {
+  size_t found = 0;
+  auto t0 = OS::cycles_since_boot();
+  for (auto i : order)
+    found += map.find(tuples[i]) != map.end();
+  auto cycles = OS::cycles_since_boot() - t0;
+  sink = found;
+  return cycles;
+}
+
+static uint64_t lookup(Table& table,
+                       const std::vector<Tuple>& tuples,
+                       const std::vector<uint32_t>& order) {
+  size_t found = 0;
+  auto t0 = OS::cycles_since_boot();
+  for (auto i : order)
+    found += table.find(tuples[i]) != nullptr;
+  auto cycles = OS::cycles_since_boot() - t0;
+  sink = found;
+  return cycles;
+}
+
+static void report(const char* name, size_t conns, uint64_t cycles, size_t ops) {
+  double hz = Hz(hw::PIT::CPUFrequency()).count();
+  double secs = cycles / hz;
+  printf("%-12s %6u conns %8.2f cycles/lookup  %12.0f lookups/sec\n",
+         name, conns, (double) cycles / ops, ops / secs);
+}
+
+static void bench(size_t conns) {
+  auto tuples = make_tuples(conns);
+
+  std::map<Tuple, Conn> map;
+  Table table;
+  for (auto& t : tuples) {
+    map.emplace(t, nullptr);
+    table.emplace(t, nullptr);
+  }
+  CHECK(map.size() == table.size(), "%u connections in both", table.size());
+
+  auto spread = make_order(map.size(), 1);
+  auto runs   = make_order(map.size(), RUN);
+
+  // Warm up both
+  lookup(map, tuples, spread);
+  lookup(table, tuples, spread);
+
+  report("map    spread", conns, lookup(map, tuples, spread), spread.size());
+  report("hashed spread", conns, lookup(table, tuples, spread), spread.size());
+  report("map    runs",   conns, lookup(map, tuples, runs), runs.size());
+  report("hashed runs",   conns, lookup(table, tuples, runs), runs.size());
+}
+
+void Service::start()
+{
+  printf("*** TCP demux benchmark: %u lookups per round ***\n", LOOKUPS);
+
+  // Let the CPU frequency estimate settle before converting cycles
+  hw::PIT::instance().onTimeout(1s, []{
+      for (size_t conns : {10, 1000, 10000})
+        bench(conns);
+
+      printf("*** TCP demux benchmark done ***\n");
+    });
+}
@@ -0,0 +1,6 @@
+#! /bin/bash
+# Same as run.sh, with a NIC that doesn't merge RX buffers (VIRTIO_NET_F_MRG_RXBUF
+# off), so every frame lands in a header + data descriptor pair instead.
+INCLUDEOS_HOME=${INCLUDEOS_HOME-$HOME/IncludeOS_install}
+export NET="-device virtio-net,netdev=net0,mac=c0:01:0a:00:00:2a,mrg_rxbuf=off -netdev tap,id=net0,script=$INCLUDEOS_HOME/etc/qemu-ifup"
+source $INCLUDEOS_HOME/etc/run.sh $@
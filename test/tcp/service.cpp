@@ -32,7 +32,7 @@ std::shared_ptr<TCP::Connection> client;
 	TEST VARIABLES
 */
 TCP::Port 
-	TEST1{8081}, TEST2{8082}, TEST3{8083}, TEST4{8084}, TEST5{8085};
+	TEST1{8081}, TEST2{8082}, TEST3{8083}, TEST4{8084}, TEST5{8085}, TEST6{8086}, TEST7{8087};
 
 using HostAddress = std::pair<std::string, TCP::Port>;
 HostAddress
@@ -181,6 +181,8 @@ void Service::start()
 			if(response->size() == big.size()) {
 				bool OK = (*response == big);
 				CHECK(OK, "conn.read() == big");
+				INFO("TEST", "ACKs saved: %u coalesced, %u piggybacked",
+					conn->acks_coalesced(), conn->acks_piggybacked());
 				conn->close();
 			}
 		});
@@ -192,6 +194,7 @@ void Service::start()
 	*/
 	tcp.bind(TEST3).onConnect([](Connection_ptr conn) {
 		INFO("TEST", "HUGE string");
+		CHECK(conn->window_scaling() and conn->timestamps(), "Window Scale and Timestamps negotiated");
 		auto buffer = std::make_shared<Buffer>(huge.size());
 		conn->onReceive([buffer](Connection_ptr conn, bool) {
 			// if not all expected data is read
@@ -216,6 +219,52 @@ void Service::start()
 	*/
 	CHECK(tcp.openPorts() == 3, "tcp.openPorts() == 3");
 
+	/*
+		TEST: Receive big string without copying, as views into the packets.
+	*/
+	tcp.bind(TEST6).onConnect([](Connection_ptr conn) {
+		INFO("TEST", "BIG string, read views");
+		auto response = std::make_shared<std::string>();
+		conn->onReceive([response](Connection_ptr conn, bool) {
+			for(auto& view : conn->read_views())
+				response->append((const char*) view.data(), view.size());
+			if(response->size() == big.size()) {
+				bool OK = (*response == big);
+				CHECK(OK, "conn.read_views() == big");
+				conn->close();
+			}
+		});
+		conn->write(big);
+	});
+
+	/*
+		TEST: Send big string as slices, owned by nothing but the connection.
+	*/
+	tcp.bind(TEST7).onConnect([](Connection_ptr conn) {
+		INFO("TEST", "BIG string, write slices");
+		auto response = std::make_shared<std::string>();
+		conn->onReceive([response](Connection_ptr conn, bool) {
+			*response += conn->read();
+			if(response->size() == big.size()) {
+				bool OK = (*response == big);
+				CHECK(OK, "conn.write(slices) == big");
+				conn->close();
+			}
+		});
+		size_t written = 0;
+		{
+			// Each slice a copy of its piece, released here after write()
+			TCP::Connection::Slices slices;
+			const size_t piece = big.size() / 4 + 1;
+			for(size_t off = 0; off < big.size(); off += piece) {
+				auto part = std::make_shared<std::string>(big, off, piece);
+				slices.push_back({part->data(), part->size(), part});
+			}
+			written = conn->write(slices);
+		}
+		CHECK(written == big.size(), "conn.write(slices) wrote all of big");
+	});
+
 	/*
 		TEST: Connection (Status etc.) and Active Close
 	*/
@@ -28,6 +28,8 @@ def connect(port):
 connect(8081)
 connect(8082)
 connect(8083)
+connect(8086)
+connect(8087)
 connect(8084)
 
 def listen(port):
@@ -0,0 +1,112 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ *  Timer wheel micro-benchmark.
+ *
+ *  Starts TIMERS outstanding one-shot timers, like a server with a
+ *  retransmission timer per unacknowledged segment, and measures:
+ *
+ *  - start:  cycles per PIT::onTimeout
+ *  - stop:   cycles per PIT::stop_timer, for every other timer (the ACKs)
+ *  - expiry: that every remaining timer fires, once, and nothing stopped does
+ *
+ *  A std::multimap of timers (what PIT used before) is timed on the same
+ *  start / stop pattern as the baseline.
+ */
+
+#include <os>
+#include <stdio.h>
+#include <map>
+#include <vector>
+
+using namespace std::chrono;
+
+static const size_t TIMERS = 100000;
+static const int    SPREAD_MS = 2000;
+
+static std::vector<hw::PIT::timer_id> ids;
+static std::vector<uint8_t> fired;
+static size_t fired_total = 0;
+static size_t fired_stopped = 0;
+
+static void report(const char* name, uint64_t cycles, size_t ops) {
+  printf("%-18s %8.2f cycles/op\n", name, (double) cycles / ops);
+}
+
+// The old way: timers ordered by expiry in a multimap, stopped by iterator
+static void baseline() {
+  std::multimap<uint64_t, std::function<void()>> timers;
+  std::vector<decltype(timers)::iterator> its;
+  its.reserve(TIMERS);
+
+  auto t0 = OS::cycles_since_boot();
+  for (size_t i = 0; i < TIMERS; i++)
+    its.push_back(timers.emplace(rand() % SPREAD_MS, []{}));
+  auto t1 = OS::cycles_since_boot();
+  for (size_t i = 0; i < TIMERS; i += 2)
+    timers.erase(its[i]);
+  auto t2 = OS::cycles_since_boot();
+
+  report("multimap start", t1 - t0, TIMERS);
+  report("multimap stop",  t2 - t1, TIMERS / 2);
+}
+
+static void wheel() {
+  auto& pit = hw::PIT::instance();
+  ids.reserve(TIMERS);
+  fired.assign(TIMERS, 0);
+
+  auto t0 = OS::cycles_since_boot();
+  for (size_t i = 0; i < TIMERS; i++) {
+    ids.push_back(pit.onTimeout(milliseconds(1 + rand() % SPREAD_MS), [i]{
+          fired[i]++;
+          fired_total++;
+          if (i % 2 == 0)
+            fired_stopped++;
+        }));
+  }
+  auto t1 = OS::cycles_since_boot();
+  for (size_t i = 0; i < TIMERS; i += 2)
+    pit.stop_timer(ids[i]);
+  auto t2 = OS::cycles_since_boot();
+
+  report("wheel start", t1 - t0, TIMERS);
+  report("wheel stop",  t2 - t1, TIMERS / 2);
+
+  CHECK(pit.active_timers() >= TIMERS / 2, "%u timers outstanding", pit.active_timers());
+}
+
+void Service::start()
+{
+  printf("*** Timer wheel benchmark: %u timers over %i ms ***\n", TIMERS, SPREAD_MS);
+
+  baseline();
+  wheel();
+
+  // Everything has expired well before this
+  hw::PIT::instance().onTimeout(milliseconds(SPREAD_MS + 1000), []{
+      size_t twice = 0;
+      for (auto f : fired)
+        twice += f > 1;
+
+      CHECK(fired_total == TIMERS / 2, "%u of %u running timers fired", fired_total, TIMERS / 2);
+      CHECK(fired_stopped == 0, "No stopped timer fired");
+      CHECK(twice == 0, "No timer fired twice");
+      printf("*** Timer wheel benchmark done ***\n");
+    });
+}
@@ -0,0 +1,181 @@
+// This file is a part of the IncludeOS unikernel - www.includeos.org
+//
+// Copyright 2015 Oslo and Akershus University College of Applied Sciences
+// and Alfred Bratterud
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <os>
+#include <stdio.h>
+#include <cassert>
+#include <cstring>
+#include <hw/dev.hpp>
+
+using buffer_t = hw::IDiskDevice::buffer_t;
+using block_t  = hw::IDiskDevice::block_t;
+
+// test.sh makes the disk: every sector starts with its own number,
+// and is filled up with that number's low byte
+static const block_t SECTORS = 65536;
+// reads queued up at once, more than any ring has room for
+static const int     MANY    = 1024;
+
+// storage device 0 is the IDE controller the image boots from
+static hw::Disk<VirtioBlk>& disk()
+{ return hw::Dev::disk<1, VirtioBlk>(); }
+
+static VirtioBlk& blk()
+{ return disk().get_driver(); }
+
+static bool sector_ok(const uint8_t* data, block_t sector)
+{
+  uint64_t num;
+  memcpy(&num, data, sizeof(num));
+  if (num != sector)
+    return false;
+  for (size_t i = sizeof(num); i < VirtioBlk::SECTOR_SIZE; i++)
+    if (data[i] != (uint8_t) sector)
+      return false;
+  return true;
+}
+
+static bool range_ok(const uint8_t* data, block_t sector, block_t count)
+{
+  for (block_t i = 0; i < count; i++)
+    if (not sector_ok(data + i * VirtioBlk::SECTOR_SIZE, sector + i))
+      return false;
+  return true;
+}
+
+static buffer_t new_buffer(block_t count)
+{
+  return buffer_t(new uint8_t[count * VirtioBlk::SECTOR_SIZE],
+                  std::default_delete<uint8_t[]>());
+}
+
+/*
+  TEST: Write more than one request, read it back, flush
+*/
+static void test_write()
+{
+  INFO("VirtioBlk", "Write and read back");
+  CHECK(not blk().read_only(), "Device takes writes");
+
+  const block_t start = 20000;
+  const block_t count = blk().max_request_sectors() + 1;
+  auto data = new_buffer(count);
+  for (size_t i = 0; i < count * VirtioBlk::SECTOR_SIZE; i++)
+    data.get()[i] = i * 7;
+
+  disk().write(start, count, data,
+  [start, count, data] (bool ok) {
+    CHECK(ok, "Wrote %llu sectors from %llu", count, start);
+
+    disk().read(start, count,
+    [count, data] (buffer_t buf) {
+      CHECK(!!buf and memcmp(buf.get(), data.get(), count * VirtioBlk::SECTOR_SIZE) == 0,
+            "Read back what was written");
+
+      disk().flush(
+      [] (bool ok) {
+        CHECK(ok, "Flushed");
+
+        // turned down before it gets to the device
+        disk().write(SECTORS, 1, new_buffer(1),
+        [] (bool ok) {
+          CHECK(not ok, "Write past the end fails");
+          INFO("VirtioBlk", "SUCCESS");
+        });
+      });
+    });
+  });
+}
+
+/*
+  TEST: More reads than the ring has room for wait their turn,
+        and read_sync polls its way past them
+*/
+static int  done   = 0;
+static bool all_ok = true;
+static bool queued = false;
+
+static void fifo_done()
+{
+  CHECK(all_ok, "%d queued reads came back right", MANY);
+  test_write();
+}
+
+static void test_fifo()
+{
+  INFO("VirtioBlk", "Queued reads");
+  for (int i = 0; i < MANY; i++) {
+    const block_t sector = 1000 + i;
+    disk().read(sector,
+    [sector] (buffer_t buf) {
+      all_ok = all_ok and buf and sector_ok(buf.get(), sector);
+      if (++done == MANY and queued)
+        fifo_done();
+    });
+  }
+  CHECK(blk().waiting() > 0, "%u requests in flight, %u waiting",
+        blk().inflight(), blk().waiting());
+
+  // behind all of them
+  auto buf = disk().read_sync(5000);
+  CHECK(!!buf and sector_ok(buf.get(), 5000), "read_sync with a full ring");
+
+  queued = true;
+  if (done == MANY)
+    fifo_done();
+}
+
+/*
+  TEST: A read larger than a device request is split up,
+        and lands in the caller's buffer
+*/
+static void test_split()
+{
+  const block_t start = 100;
+  const block_t count = 2 * blk().max_request_sectors() + 3;
+  INFO("VirtioBlk", "Read of %llu sectors, %u per request",
+       count, blk().max_request_sectors());
+
+  auto mine = new_buffer(count);
+  blk().read(start, count, mine,
+  [start, count, mine] (buffer_t buf) {
+    CHECK(buf == mine, "Read into the buffer given");
+    CHECK(!!buf and range_ok(buf.get(), start, count), "%llu sectors read right", count);
+    test_fifo();
+  });
+  CHECK(blk().inflight() + blk().waiting() == 3, "Read split in 3 requests");
+}
+
+void Service::start()
+{
+  INFO("VirtioBlk", "Running tests for VirtioBlk");
+
+  CHECK(disk().size() == SECTORS, "Disk size %llu sectors", disk().size());
+  assert(disk().size() == SECTORS);
+
+  auto buf = disk().read_sync(0);
+  CHECK(!!buf and sector_ok(buf.get(), 0), "read_sync of sector 0");
+  buf = disk().read_sync(SECTORS - 1);
+  CHECK(!!buf and sector_ok(buf.get(), SECTORS - 1), "read_sync of the last sector");
+
+  disk().read(SECTORS, 1,
+  [] (buffer_t buf) {
+    CHECK(!buf, "Read past the end fails");
+  });
+
+  test_split();
+}
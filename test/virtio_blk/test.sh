@@ -0,0 +1,19 @@
+#!/bin/bash
+source ../test_base
+
+# 32MB (65536 sectors): each sector starts with its number (64 bit),
+# and is filled up with the number's low byte
+rm -f blk.disk
+python3 -c "
+import struct
+with open('blk.disk', 'wb') as f:
+    for i in range(65536):
+        f.write(struct.pack('<Q', i) + bytes([i & 0xff]) * 504)
+"
+
+export QEMU_EXTRA="-drive file=blk.disk,if=virtio,format=raw"
+make SERVICE=Test FILES=service.cpp
+start Test.img "VirtioBlk: Split, queued, write and flush test"
+make SERVICE=Test FILES=service.cpp clean
+
+rm -f blk.disk